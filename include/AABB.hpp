@@ -11,40 +11,103 @@ class AABB {
 public:
 
     AABB(glm::vec3 bl_ = glm::vec3(), glm::vec3 tr_ = glm::vec3())
-        : bl(bl_), tr(tr_)
+        : bounds{bl_, tr_}
     {
     }
 
+    // Box containing nothing, expanding it by anything yields that thing
+    static AABB empty()
+    {
+        return AABB(glm::vec3(INFINITY), glm::vec3(-INFINITY));
+    }
+
     // Expand to fit box
     void expand(const AABB& box)
     {
-        if (box.bl.x < bl.x) bl.x = box.bl.x;
+        if (box.bounds[0].x < bounds[0].x) bounds[0].x = box.bounds[0].x;
 
-        if (box.bl.y < bl.y) bl.y = box.bl.y;
+        if (box.bounds[0].y < bounds[0].y) bounds[0].y = box.bounds[0].y;
 
-        if (box.bl.z < bl.z) bl.z = box.bl.z;
+        if (box.bounds[0].z < bounds[0].z) bounds[0].z = box.bounds[0].z;
 
-        if (box.tr.x > tr.x) tr.x = box.tr.x;
+        if (box.bounds[1].x > bounds[1].x) bounds[1].x = box.bounds[1].x;
 
-        if (box.tr.y > tr.y) tr.y = box.tr.y;
+        if (box.bounds[1].y > bounds[1].y) bounds[1].y = box.bounds[1].y;
 
-        if (box.tr.z > tr.z) tr.z = box.tr.z;
+        if (box.bounds[1].z > bounds[1].z) bounds[1].z = box.bounds[1].z;
     }
 
     // Expand to fit point
     void expand(const glm::vec3& vec)
     {
-        if (vec.x < bl.x) bl.x = vec.x;
+        if (vec.x < bounds[0].x) bounds[0].x = vec.x;
+
+        if (vec.y < bounds[0].y) bounds[0].y = vec.y;
+
+        if (vec.z < bounds[0].z) bounds[0].z = vec.z;
+
+        if (vec.x > bounds[1].x) bounds[1].x = vec.x;
+
+        if (vec.y > bounds[1].y) bounds[1].y = vec.y;
+
+        if (vec.z > bounds[1].z) bounds[1].z = vec.z;
+    }
+
+    // Box of the space inside both boxes, empty if they are disjoint
+    AABB overlap(const AABB& box) const
+    {
+        return AABB(glm::max(bounds[0], box.bounds[0]), glm::min(bounds[1], box.bounds[1]));
+    }
+
+    // Box around this box moved by matrix
+    AABB transform(const glm::mat4& matrix) const
+    {
+        AABB box = empty();
+
+        for (int corner = 0; corner < 8; corner++)
+        {
+            const glm::vec3 point((corner & 1) ? bounds[1].x : bounds[0].x,
+                                  (corner & 2) ? bounds[1].y : bounds[0].y,
+                                  (corner & 4) ? bounds[1].z : bounds[0].z);
+
+            box.expand(glm::vec3(matrix * glm::vec4(point, 1.0f)));
+        }
+
+        return box;
+    }
+
+    bool isEmpty() const
+    {
+        return (bounds[0].x > bounds[1].x) || (bounds[0].y > bounds[1].y) || (bounds[0].z > bounds[1].z);
+    }
+
+    const glm::vec3& getMin() const
+    {
+        return bounds[0];
+    }
 
-        if (vec.y < bl.y) bl.y = vec.y;
+    const glm::vec3& getMax() const
+    {
+        return bounds[1];
+    }
 
-        if (vec.z < bl.z) bl.z = vec.z;
+    glm::vec3 getCenter() const
+    {
+        return (bounds[0] + bounds[1]) * 0.5f;
+    }
+
+    // Half of the surface area, which is all the SAH needs
+    float getHalfArea() const
+    {
+        glm::vec3 diff = glm::max(bounds[1] - bounds[0], glm::vec3(0.0f));
+
+        return diff.x * diff.y + diff.y * diff.z + diff.z * diff.x;
     }
 
     // Returns longest axis: 0, 1, 2 for x, y, z respectively
     int get_longest_axis()
     {
-        glm::vec3 diff = tr - bl;
+        glm::vec3 diff = bounds[1] - bounds[0];
 
         if ((diff.x > diff.y) && (diff.x > diff.z)) return 0;
 
@@ -53,37 +116,45 @@ public:
         return 2;
     }
 
-    // Check if ray intersects with box. Returns true/false and stores distance in t
-    bool intersection(const Ray& r, float& t)
+    // Check if ray enters box before tMax. Stores the entry distance, 0 if the
+    // origin is inside, in tEntry
+    bool intersection(const Ray& r, float tMax, float& tEntry) const
     {
-        // TODO: The release build of these functions will cause issues, not sure why
-        //glm::vec3 t_bl = (bl - r.origin) * r.direction_inv;
-        //glm::vec3 t_tr = (tr - r.origin) * r.direction_inv;
-        //glm::vec3 tMax = glm::max(t_bl, t_tr);
-        //glm::vec3 tMin = glm::min(t_bl, t_tr);
+        float tExit;
 
-        glm::vec3 tMin = (bl - r.origin) * r.direction_inv;
-        glm::vec3 tMax = (tr - r.origin) * r.direction_inv;
+        return intersection(r, tMax, tEntry, tExit);
+    }
 
-        Math::sortByComponent(tMax, tMin);
+    // Same as above, also stores the exit distance, at most tMax, in tExit.
+    // The near corner on each axis is picked by the sign of the ray, so there
+    // is no swap to branch on. A zero direction component has an infinite
+    // inverse, which gives a NaN for an origin on a slab plane. min and max
+    // return their first argument when the second one is NaN, so that slab
+    // is skipped, it contains the whole ray anyway.
+    bool intersection(const Ray& r, float tMax, float& tEntry, float& tExit) const
+    {
+        const float xNear = (bounds[r.sign[0]].x - r.origin.x) * r.direction_inv.x;
+        const float xFar  = (bounds[1 - r.sign[0]].x - r.origin.x) * r.direction_inv.x;
+        const float yNear = (bounds[r.sign[1]].y - r.origin.y) * r.direction_inv.y;
+        const float yFar  = (bounds[1 - r.sign[1]].y - r.origin.y) * r.direction_inv.y;
+        const float zNear = (bounds[r.sign[2]].z - r.origin.z) * r.direction_inv.z;
+        const float zFar  = (bounds[1 - r.sign[2]].z - r.origin.z) * r.direction_inv.z;
 
-        float minOfMax = std::min(tMax.x, std::min(tMax.y, tMax.z));
-        if (minOfMax < 0)
-        {
-            t = minOfMax;
-            return false;
-        }
+        tEntry = std::max(std::max(std::max(0.0f, xNear), yNear), zNear);
 
-        float maxOfMin = std::max(tMin.x, std::max(tMin.y, tMin.z));
-        t = maxOfMin > 0 ? maxOfMin : minOfMax;
+        // Widened by the rounding error of the products, so that a ray through
+        // an edge or corner cannot slip between two boxes (Ize 2013)
+        tExit = std::min(std::min(std::min(tMax, xFar * EXIT_SCALE), yFar * EXIT_SCALE), zFar * EXIT_SCALE);
 
-        return minOfMax >= maxOfMin;
+        return tEntry <= tExit;
     }
 
 private:
 
-    glm::vec3 bl; // Bottom left (min)
-    glm::vec3 tr; // Top right   (max)
+    // 1 + 2 * gamma(3), gamma(n) bounding the relative error of n float operations
+    static constexpr float EXIT_SCALE = 1.0000004f;
+
+    glm::vec3 bounds[2]; // Min and max corner, indexed by Ray::sign
 };
 
 #endif // AABBOX_H
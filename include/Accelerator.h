@@ -0,0 +1,104 @@
+#ifndef ACCELERATOR_H
+#define ACCELERATOR_H
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <ostream>
+
+#include "Triangle.h"
+#include "Ray.hpp"
+#include "RayPacket.h"
+
+// SAH costs, relative to the cost of one triangle intersection
+const float SAH_TRAVERSAL_COST    = 1.0f;
+const float SAH_INTERSECTION_COST = 1.0f;
+
+// Order of the nodes in the flattened tree
+enum class TreeLayout
+{
+    DepthFirst, // Every subtree is contiguous, following its root
+    VanEmdeBoas // Recursively cut at half height, cache oblivious
+};
+
+// How the BVH is built
+enum class BuildMethod
+{
+    BinnedSAH, // Top down, best trees
+    Morton     // Linear, from the Morton order of the centroids. Fastest build, for previews of large meshes
+};
+
+// What the hierarchy of a mesh splits
+enum class Partitioning
+{
+    Object, // Triangles, as a BVH whose boxes may overlap
+    Spatial // Space, as a kd-tree whose cells may share triangles
+};
+
+// The BVH settings do not apply to the kd-tree. splitGrowth allows spatial
+// splits in the binned SAH build, adding at most that fraction of the triangle
+// count as extra references. 0 turns them off.
+struct BuildOptions
+{
+    Partitioning partitioning = Partitioning::Object;
+    BuildMethod  method       = BuildMethod::BinnedSAH; // BVH only
+    TreeLayout   layout       = TreeLayout::DepthFirst; // BVH only
+    float        splitGrowth  = 0.0f;                   // BVH only
+    unsigned     width        = 2;                      // BVH only. Children per node: 2 for the binary tree, 4 or 8 for a wide BVH
+};
+
+// Build quality of a tree. The SAH cost is the expected cost of tracing a ray
+// that hits the root box, in units of one triangle intersection.
+struct TreeStats
+{
+    // Leaf sizes 0 .. LEAF_HISTOGRAM_SIZE - 2, the last bucket holds the rest
+    static const int LEAF_HISTOGRAM_SIZE = 17;
+
+    long  nodes                          = 0;
+    long  leaves                         = 0;
+    long  references                     = 0;
+    int   maxDepth                       = 0;
+    float sahCost                        = 0.0f;
+    long  leafSizes[LEAF_HISTOGRAM_SIZE] = {};
+
+    void addLeaf(long size, float area, int depth);
+
+    void addInner(float area, int depth);
+
+    void add(const TreeStats& other);
+
+    void print(std::ostream& out) const;
+};
+
+// Acceleration structure over the triangles of one mesh
+class Accelerator {
+public:
+
+    virtual ~Accelerator()
+    {}
+
+    // Builds the structure selected by options
+    static std::shared_ptr<Accelerator> build(const std::vector<Triangle *>& tris,
+                                              const BuildOptions           & options);
+
+    // Finds nearest triangle that intersects with ray and is closer than tmin
+    virtual bool hit(const Ray& ray,
+                     float    & tmin,
+                     long     & tri_idx) const = 0;
+
+    // Whether any triangle intersects with ray closer than tMax
+    virtual bool occluded(const Ray& ray,
+                          float      tMax) const = 0;
+
+    // Finds for every ray of packet from first on the nearest triangle closer
+    // than its tmin, see hit. Returns a mask of the rays that found one. Trees
+    // without a packet traversal trace the rays one by one.
+    virtual uint64_t hitPacket(const RayPacket& packet,
+                               unsigned         first,
+                               float          * tmin,
+                               long           * tri_idx) const;
+
+    virtual TreeStats getStats() const = 0;
+};
+
+#endif // ACCELERATOR_H
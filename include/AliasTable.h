@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "Random.hpp"
+
+// Picks one of a fixed set of entries with a probability proportional to its
+// weight, in constant time (Walker 1977, built by Vose's method). Each column
+// holds an entry and the alias it falls back to, the column is picked
+// uniformly and then one of the two by the probability kept for the entry.
+class AliasTable {
+public:
+
+    AliasTable()
+    {}
+
+    // Negative weights count as 0, there must be a positive one
+    explicit AliasTable(const std::vector<float>& weights);
+
+    bool empty() const
+    {
+        return columns.empty();
+    }
+
+    unsigned size() const
+    {
+        return (unsigned)columns.size();
+    }
+
+    // Probability of entry index being picked
+    float getProbability(unsigned index) const
+    {
+        return columns[index].probability;
+    }
+
+    // Takes a single number from random, its high bits pick the column and
+    // the rest decides between the entry and the alias
+    unsigned sample(Random& random) const
+    {
+        const uint64_t scaled = (uint64_t)random.nextUInt() * columns.size();
+        const Column & column = columns[scaled >> 32];
+        const float    coin   = (uint32_t)scaled * (1.0f / 4294967296.0f);
+
+        return coin < column.threshold ? (unsigned)(scaled >> 32) : column.alias;
+    }
+
+private:
+
+    struct Column
+    {
+        float    threshold;   // Share of the column kept for its own entry
+        float    probability; // Of the entry overall
+        unsigned alias;
+    };
+
+    std::vector<Column>columns;
+};
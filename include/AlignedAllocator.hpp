@@ -0,0 +1,52 @@
+#pragma once
+
+#include <new>
+#include <cstddef>
+
+#include <xmmintrin.h>
+
+// Allocator for containers whose elements need more alignment than new gives
+template<typename T, size_t Alignment = 64>
+struct AlignedAllocator
+{
+    typedef T value_type;
+
+    template<typename U>
+    struct rebind
+    {
+        typedef AlignedAllocator<U, Alignment>other;
+    };
+
+    AlignedAllocator()
+    {}
+
+    template<typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&)
+    {}
+
+    T* allocate(size_t n)
+    {
+        void* p = _mm_malloc(n * sizeof(T), Alignment);
+
+        if (!p) throw std::bad_alloc();
+
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T* p, size_t)
+    {
+        _mm_free(p);
+    }
+};
+
+template<typename T, typename U, size_t Alignment>
+inline bool operator==(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&)
+{
+    return true;
+}
+
+template<typename T, typename U, size_t Alignment>
+inline bool operator!=(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&)
+{
+    return false;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <new>
+#include <mutex>
+#include <vector>
+#include <cstddef>
+#include <utility>
+#include <type_traits>
+
+// Bump allocator handing out memory from large blocks. Nothing is freed on its
+// own, all blocks go at once with the arena, so the objects created in it are
+// never destroyed and must not need a destructor. Allocation may happen from
+// several threads at the same time. Each thread of the outermost OpenMP team
+// bumps through a block of its own and only locks to get the next one, other
+// threads share a block under the lock.
+class Arena {
+public:
+
+    static const size_t DEFAULT_BLOCK_SIZE = 1 << 20;
+
+    explicit Arena(size_t blockSize = DEFAULT_BLOCK_SIZE);
+
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // Blocks allocated afterwards are backed by transparent huge pages where
+    // the system supports them, which saves TLB misses on large scenes
+    void setHugePages(bool enable);
+
+    void* allocate(size_t size,
+                   size_t alignment);
+
+    // Uninitialized room for count objects of type T
+    template<typename T>
+    T* allocateArray(size_t count)
+    {
+        return static_cast<T *>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    template<typename T, typename ... Args>
+    T* create(Args&& ... args)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "Arena objects are never destroyed");
+
+        return new (allocate(sizeof(T), alignof(T)))T(std::forward<Args>(args) ...);
+    }
+
+    // Bytes taken from the system so far
+    size_t getReservedSize() const
+    {
+        return reserved;
+    }
+
+private:
+
+    struct Block
+    {
+        char*  data;
+        size_t size;
+        bool   huge;
+    };
+
+    // Free part of the block a thread allocates from, a cache line each so
+    // that threads do not write to the same line
+    struct Cursor
+    {
+        char* next = nullptr;
+        char* end  = nullptr;
+        char  padding[64 - 2 * sizeof(char *)];
+    };
+
+    // Cursor of the calling thread, null if it has to share one
+    Cursor* threadCursor();
+
+    // Block of at least minSize bytes, owned by the arena from now on
+    const Block& addBlock(size_t minSize);
+
+    size_t blockSize;
+    bool   hugePages = false;
+    size_t reserved  = 0;
+    std::vector<Cursor>cursors; // By OpenMP thread number
+    Cursor shared;
+    std::vector<Block>blocks;
+    std::mutex lock;
+};
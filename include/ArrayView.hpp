@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+// Read-only view of an array that lives elsewhere, in a vector or a mapped
+// cache file
+template<typename T>
+class ArrayView {
+public:
+
+    ArrayView()
+    {}
+
+    ArrayView(const T* data, size_t size)
+        : first(data), count(size)
+    {}
+
+    template<typename Allocator>
+    ArrayView(const std::vector<T, Allocator>& vector)
+        : first(vector.data()), count(vector.size())
+    {}
+
+    const T& operator[](size_t i) const
+    {
+        return first[i];
+    }
+
+    const T* data() const
+    {
+        return first;
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+private:
+
+    const T* first = nullptr;
+    size_t count   = 0;
+};
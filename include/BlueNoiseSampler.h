@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+
+#include "SobolSampler.h"
+
+// Screen space blue noise (Georgiev and Fajardo 2016). All pixels take the
+// same Owen-scrambled Sobol points and shift each dimension, modulo 1, by the
+// value of a blue noise mask at the pixel. Neighbouring pixels then get very
+// different shifts, so the error of an image with few samples looks like blue
+// noise rather than white. Each dimension reads the mask at an offset of its
+// own. The mask is built by the void-and-cluster method (Ulichney 1993).
+class BlueNoiseSampler : public Sampler {
+public:
+
+    static const int MASK_SIZE = 64;
+
+    explicit BlueNoiseSampler(uint32_t seed = 0);
+
+    uint32_t sample(uint32_t index,
+                    uint32_t dimension,
+                    uint32_t x,
+                    uint32_t y) const override;
+
+    uint32_t getDimensions() const override
+    {
+        return UINT32_MAX;
+    }
+
+private:
+
+    // Fills mask with the rank of each texel, as a fraction of 2^32
+    void buildMask(uint32_t seed);
+
+    SobolSampler sobol;
+    std::vector<uint32_t> mask;
+};
@@ -5,6 +5,7 @@
 
 #include "Scene.h"
 #include "Renderer.h"
+#include "Sampler.h"
 
 struct HumanTime {
     long long h, m, s;
@@ -25,6 +26,27 @@ public:
 
     bool writeImageTGA(const std::string& path = "output.tga") const;
 
+    // Samples of a pixel are traced in packets of size x size rays, 0 traces
+    // every ray alone. At most 8, see RayPacket::MAX_SIZE.
+    void setPacketSize(unsigned int size)
+    {
+        packetSize = size;
+    }
+
+    // Traces all samples breadth first through Renderer::traceWavefront
+    // instead of one path after the other. Packets are not used then.
+    void setWavefront(bool enabled)
+    {
+        wavefront = enabled;
+    }
+
+    // Points the samples of each pixel are taken from, null for independent
+    // random numbers
+    void setSampler(std::shared_ptr<Sampler> sampler_)
+    {
+        sampler = sampler_;
+    }
+
 private:
 
     void createImage();
@@ -35,6 +57,9 @@ private:
 
     unsigned int width;
     unsigned int height;
+    unsigned int packetSize = 0;
+    bool wavefront          = false;
+    std::shared_ptr<Sampler> sampler;
 
     // Pixel containers
     std::vector<std::vector<glm::vec3> >pixels;
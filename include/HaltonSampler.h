@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+
+#include "Sampler.h"
+
+// Halton points, the radical inverse of the sample index in the n-th prime
+// base for dimension n. The digits are scrambled like Owen scrambling does in
+// base 2: each one goes through a random linear permutation that depends on
+// the pixel, the dimension and the digits before it (Matousek 1998). Without
+// that the first few samples in a large base would all be close to 0. The
+// higher bases still correlate, so the points stop after MAX_DIMENSIONS.
+class HaltonSampler : public Sampler {
+public:
+
+    static const uint32_t MAX_DIMENSIONS = 32;
+
+    explicit HaltonSampler(uint32_t seed = 0);
+
+    uint32_t sample(uint32_t index,
+                    uint32_t dimension,
+                    uint32_t x,
+                    uint32_t y) const override;
+
+    uint32_t getDimensions() const override
+    {
+        return MAX_DIMENSIONS;
+    }
+
+private:
+
+    uint32_t seed;
+    std::vector<uint32_t> primes;
+};
@@ -2,38 +2,147 @@
 #define KDTREE_H
 
 #include <vector>
+#include <ostream>
 
 #include "Triangle.h"
 #include "Ray.hpp"
 #include "AABB.hpp"
+#include "AlignedAllocator.hpp"
+#include "Arena.h"
+#include "ArrayView.hpp"
+#include "Accelerator.h"
+#include "TrianglePackets.h"
 
+// Triangle as seen by the builder, with the bounds and centroid it is sorted by
+struct PrimitiveRef
+{
+    AABB      box;
+    glm::vec3 center;
+    Triangle* triangle;
+};
+
+struct SpatialSplits;
+
+// Build time node, only lives until the tree is flattened. The nodes and their
+// triangle lists are taken from an arena owned by the caller of the build,
+// which frees all of them at once.
 class KDNode {
 public:
 
     KDNode() :
-        leaf(false),
-        triangles(std::vector<Triangle *>()),
+        box(AABB()),
         left(nullptr),
         right(nullptr),
-        box(AABB())
+        triangles(nullptr),
+        triangleCount(0),
+        leaf(false),
+        axis(0)
     {}
 
-    KDNode* build(std::vector<Triangle *>& tris,
-                  int                      depth);
+    KDNode(const KDNode&)            = delete;
+    KDNode& operator=(const KDNode&) = delete;
 
-    bool    hit(KDNode   * node,
-                const Ray& ray,
-                float    & t,
-                float    & tmin,
-                long     & tri_idx);
+    // Builds a tree over tris as set in options
+    static KDNode* buildTree(const std::vector<Triangle *>& tris,
+                             const BuildOptions           & options,
+                             Arena                        & arena);
 
-private:
+    // Linear build: centroids sorted by Morton code, the hierarchy taken from
+    // the common prefixes of the codes and small subtrees collapsed by SAH
+    static KDNode* buildLinear(const std::vector<Triangle *>& tris,
+                               Arena                        & arena);
+
+    // Binned SAH build over refs[0, count), which gets partitioned in place.
+    // Large subtrees are built as OpenMP tasks where tasks are supported.
+    // With spatial set, nodes may also be split by a plane that divides the
+    // references crossing it, the children then get arrays of their own.
+    static KDNode* build(PrimitiveRef * refs,
+                         size_t         count,
+                         int            depth,
+                         SpatialSplits* spatial,
+                         Arena        * arena);
+
+    void makeLeaf(const PrimitiveRef* refs,
+                  size_t              count,
+                  Arena             & arena);
 
     AABB box;
     KDNode* left;
     KDNode* right;
-    std::vector<Triangle *>triangles;
+    Triangle** triangles; // Leaf: triangleCount triangles
+    size_t triangleCount;
     bool leaf;
+    int axis;
+};
+
+// Flattened node, two of them share a cache line. The children of a node are
+// stored next to each other so both boxes are fetched together.
+struct alignas(32) KDTreeNode
+{
+    AABB     box;
+    unsigned offset;     // Leaf: first triangle packet. Inner: left child, right is offset + 1
+    unsigned count : 30; // Leaf: triangle count. Inner: 0
+    unsigned axis  : 2;  // Inner: split axis
+};
+
+// The tree of a mesh, built once and then only traversed
+class KDTree : public Accelerator {
+public:
+
+    // The builders never go deeper, so the traversal stack cannot overflow.
+    // Morton trees may take one level per code bit plus 32 to tell equal codes apart.
+    static const int MAX_DEPTH = 96;
+
+    KDTree(const std::vector<Triangle *>& tris,
+           const BuildOptions           & options = BuildOptions());
+
+    // Tree whose arrays are owned by someone else, e.g. a mapped cache file
+    KDTree(ArrayView<KDTreeNode>     nodes,
+           ArrayView<TrianglePacket> packets);
+
+    // Flattened arrays of the tree, for storing it
+    ArrayView<KDTreeNode> getNodes() const
+    {
+        return nodes;
+    }
+
+    ArrayView<TrianglePacket> getPackets() const
+    {
+        return packets.getPackets();
+    }
+
+    bool hit(const Ray& ray,
+             float    & tmin,
+             long     & tri_idx) const override;
+
+    bool occluded(const Ray& ray,
+                  float      tMax) const override;
+
+    uint64_t hitPacket(const RayPacket& packet,
+                       unsigned         first,
+                       float          * tmin,
+                       long           * tri_idx) const override;
+
+    TreeStats getStats() const override;
+
+private:
+
+    template<bool AnyHit>
+    bool traverse(const Ray& ray,
+                  float    & tmin,
+                  long     & tri_idx) const;
+
+    void flatten(const KDNode* root,
+                 TreeLayout    layout);
+
+    void collectStats(TreeStats& stats,
+                      unsigned   nodeIndex,
+                      int        depth,
+                      float      invRootArea) const;
+
+    std::vector<KDTreeNode, AlignedAllocator<KDTreeNode> >nodeStorage;
+    ArrayView<KDTreeNode> nodes;
+    TrianglePackets packets;
 };
 
 #endif // KDTREE_H
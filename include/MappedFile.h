@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+// Whole file mapped read-only into memory. Every process mapping the same file
+// shares its pages.
+class MappedFile {
+public:
+
+    explicit MappedFile(const std::string& path);
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // False if the file could not be opened or mapped
+    bool isOpen() const
+    {
+        return base != nullptr;
+    }
+
+    const char* data() const
+    {
+        return base;
+    }
+
+    size_t size() const
+    {
+        return length;
+    }
+
+private:
+
+    const char* base = nullptr;
+    size_t length    = 0;
+#ifdef _WIN32
+    void* file    = nullptr;
+    void* mapping = nullptr;
+#endif
+};
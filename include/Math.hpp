@@ -10,6 +10,8 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/constants.hpp>
 
+#include "Random.hpp"
+
 namespace Math {
 // Returns a vector with indices sorted based on the values in the vector values
 static inline std::vector<int>getSortedIndices(const std::vector<float>& values)
@@ -94,11 +96,11 @@ static inline glm::vec3 nonParallellVector(const glm::vec3& v)
 
 // Returns a random direction given a normal
 // Uses cosine-weighted hemisphere sampling
-static inline glm::vec3 sampleHemisphereWeighted(const glm::vec3& n)
+static inline glm::vec3 sampleHemisphereWeighted(const glm::vec3& n, Random& random)
 {
     // Samples cosine weighted positions.
-    float r1    = rand() / static_cast<float>(RAND_MAX);
-    float r2    = rand() / static_cast<float>(RAND_MAX);
+    float r1    = random.nextFloat();
+    float r2    = random.nextFloat();
     float theta = acos(sqrt(1.0f - r1));
     float phi   = 2.0f * glm::pi<float>() * r2;
     float xs    = sinf(theta) * cosf(phi);
@@ -128,11 +130,11 @@ static inline glm::vec3 sampleHemisphereWeighted(const glm::vec3& n)
 
 // Returns a random direction given a normal
 // Uses uniform randomization
-static inline glm::vec3 sampleHemisphereUniform(const glm::vec3& n)
+static inline glm::vec3 sampleHemisphereUniform(const glm::vec3& n, Random& random)
 {
     // Samples uniform angles.
-    float incl                   = (rand() / static_cast<float>(RAND_MAX)) * glm::half_pi<float>();
-    float azim                   = (rand() / static_cast<float>(RAND_MAX)) * glm::two_pi<float>();
+    float incl                   = random.nextFloat() * glm::half_pi<float>();
+    float azim                   = random.nextFloat() * glm::two_pi<float>();
     glm::vec3 nonParallellVector = Math::nonParallellVector(n);
 
     assert(glm::length(glm::cross(nonParallellVector,
@@ -155,11 +157,4 @@ static inline float schlicksApprox(
     return R0 + (1 - R0) * glm::pow((1 - alpha), 5.0f);
 }
 
-static inline void sortByComponent(glm::vec3& a, glm::vec3& b)
-{
-    if (a.x < b.x) std::swap(a.x, b.x);
-    if (a.y < b.y) std::swap(a.y, b.y);
-    if (a.z < b.z) std::swap(a.z, b.z);
-}
-
 } // namespace Math
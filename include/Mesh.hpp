@@ -5,7 +5,7 @@
 
 #include "Material.hpp"
 #include "Triangle.h"
-#include "KDTree.h"
+#include "Accelerator.h"
 
 class Scene;
 class Renderer;
@@ -21,36 +21,112 @@ struct ObjectIntersection
     {}
 };
 
+// Triangles of a mesh in its object space and their tree, shared by every
+// mesh placed from the same object. The triangles live in the arena of the
+// scene or in a mapped scene cache.
+struct MeshGeometry
+{
+    std::vector<Triangle *>triangles;
+    std::shared_ptr<Accelerator> tree;
+    AABB box;
+};
+
 class Mesh {
 public:
 
-    Mesh(Material* mat) :
-        material(mat)
+    Mesh(Material* mat, std::shared_ptr<MeshGeometry> geo) :
+        material(mat), geometry(std::move(geo))
     {}
 
-    glm::vec3 getRandomPositionOnSurface() const
+    // Copy that shares the geometry, placed in the world by modelMatrix
+    Mesh instance(const glm::mat4& modelMatrix) const
+    {
+        Mesh placed(*this);
+
+        placed.setTransform(modelMatrix);
+
+        return placed;
+    }
+
+    // Places the object space geometry in the world by modelMatrix
+    void setTransform(const glm::mat4& modelMatrix)
+    {
+        transformed   = modelMatrix != glm::mat4();
+        toWorld       = modelMatrix;
+        toObject      = glm::inverse(modelMatrix);
+        normalToWorld = glm::transpose(glm::mat3(toObject));
+        box           = transformed ? geometry->box.transform(toWorld) : geometry->box;
+    }
+
+    // World space normal of triangle index at world space position
+    glm::vec3 getNormal(long index, const glm::vec3& position) const
     {
-        const auto triangle = triangles[rand() % triangles.size()];
+        const Triangle* triangle = geometry->triangles[index];
 
-        return triangle->getRandomPositionOnSurface();
+        if (!transformed) return triangle->getNormal(position);
+
+        return glm::normalize(normalToWorld * triangle->getNormal(glm::vec3(toObject * glm::vec4(position, 1.0f))));
     }
 
-    ObjectIntersection getIntersection(const Ray& ray) const
+    // Closest intersection nearer than tMax
+    ObjectIntersection getIntersection(const Ray& ray, float tMax = INFINITY) const
     {
-        float t = 0, tmin = INFINITY;
+        float tmin  = tMax;
         long  index = 0;
-        bool  hit   = node->hit(node, ray, t, tmin, index);
+        bool  hit   = geometry->tree->hit(rayToObject(ray), tmin, index);
 
         return ObjectIntersection(hit, tmin, index);
     }
 
+    // Closest intersections of the rays of packet from first on, each nearer
+    // than its tMax. Returns a mask of the rays that hit.
+    uint64_t getPacketIntersection(const RayPacket& packet, unsigned first, float* tMax, long* index) const
+    {
+        if (!transformed) return geometry->tree->hitPacket(packet, first, tMax, index);
+
+        RayPacket objectPacket;
+
+        for (unsigned i = 0; i < packet.size(); i++)
+        {
+            objectPacket.add(rayToObject(packet[i]));
+        }
+
+        return geometry->tree->hitPacket(objectPacket, first, tMax, index);
+    }
+
+    // Whether anything in the mesh blocks ray before tMax
+    bool isOccluded(const Ray& ray, float tMax) const
+    {
+        return geometry->tree->occluded(rayToObject(ray), tMax);
+    }
+
 private:
 
-    bool enabled = true;
-    bool convex  = true;
+    // The direction is not normalized, so distances along the ray are the
+    // same in both spaces
+    Ray rayToObject(const Ray& ray) const
+    {
+        if (!transformed) return ray;
+
+        return Ray(glm::vec3(toObject * glm::vec4(ray.origin, 1.0f)), glm::mat3(toObject) * ray.direction);
+    }
+
+    glm::vec3 pointToWorld(const glm::vec3& point) const
+    {
+        if (!transformed) return point;
+
+        return glm::vec3(toWorld * glm::vec4(point, 1.0f));
+    }
+
+    bool enabled     = true;
+    bool convex      = true;
+    bool transformed = false; // Object space is world space otherwise
     Material* material;
-    std::vector<Triangle *>triangles;
-    KDNode* node;
+    std::shared_ptr<MeshGeometry> geometry;
+    glm::mat4 toWorld;
+    glm::mat4 toObject;
+    glm::mat3 normalToWorld;
+    AABB box; // In world space
 
     friend Scene;
     friend Renderer;
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "AABB.hpp"
+
+// Building blocks of the linear BVH builder: Morton codes, a parallel radix
+// sort over them and the hierarchy they imply
+namespace Morton {
+struct Item
+{
+    uint64_t code;
+    unsigned index; // Into the points the codes were computed from
+};
+
+// Inner node of the hierarchy over n sorted items, there are n - 1 of them
+// and node 0 is the root. Children below n - 1 are inner nodes unless flagged
+// as leaves, in which case they are item positions.
+struct Node
+{
+    unsigned child[2];
+    bool     leaf[2];
+    unsigned first; // Item range covered by the node
+    unsigned last;
+};
+
+// Codes of points quantized to bitsPerAxis bits per axis inside bounds.
+// Up to 21 bits per axis fit, giving 63 bit codes.
+void encode(const std::vector<glm::vec3>& points,
+            const AABB                  & bounds,
+            int                           bitsPerAxis,
+            std::vector<Item>           & items);
+
+// Stable LSD radix sort of items by the lowest bits of their codes
+void sort(std::vector<Item>& items,
+          int                bits);
+
+// Emits the radix tree over sorted items, every inner node independently
+// (Karras 2012). Equal codes are told apart by their position.
+void buildHierarchy(const std::vector<Item>& items,
+                    std::vector<Node>      & nodes);
+} // namespace Morton
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Sampler.h"
+
+// PCG32 generator (O'Neill 2014). Cheap to copy and free of locks, so every
+// path carries one of its own. A generator only depends on its seed and
+// stream, which keeps renders the same for any number of threads.
+// With a sampler set, numbers are the coordinates of a sample point instead,
+// one dimension after the other, until the sampler runs out of dimensions.
+class Random {
+public:
+
+    // Camera samples use the index of their pixel as the stream and the index
+    // of the sample within the pixel as the seed
+    explicit Random(uint64_t seed = 0, uint64_t stream = 0)
+        : state(0), increment((mix(stream) << 1) | 1)
+    {
+        nextRandom();
+        state += mix(seed);
+        nextRandom();
+    }
+
+    // Take the numbers from sample index of pixel (x, y) of sampler, null for
+    // none
+    void setSampler(const Sampler* sampler_, uint32_t index, uint32_t x, uint32_t y)
+    {
+        sampler     = sampler_;
+        sampleIndex = index;
+        dimension   = 0;
+        pixelX      = x;
+        pixelY      = y;
+    }
+
+    uint32_t nextUInt()
+    {
+        if (sampler && (dimension < sampler->getDimensions()))
+        {
+            return sampler->sample(sampleIndex, dimension++, pixelX, pixelY);
+        }
+
+        return nextRandom();
+    }
+
+    // Uniform in [0, 1)
+    float nextFloat()
+    {
+        return (nextUInt() >> 8) * (1.0f / (1 << 24));
+    }
+
+    // Generator for a branch of the path, independent of this one from now on.
+    // It goes on with the sample dimensions where this one is.
+    Random split()
+    {
+        const uint64_t high = nextRandom();
+        const uint64_t low  = nextRandom();
+        Random branch((high << 32) | low, increment >> 1);
+
+        branch.sampler     = sampler;
+        branch.sampleIndex = sampleIndex;
+        branch.dimension   = dimension;
+        branch.pixelX      = pixelX;
+        branch.pixelY      = pixelY;
+
+        return branch;
+    }
+
+private:
+
+    uint32_t nextRandom()
+    {
+        const uint64_t old = state;
+
+        state = old * MULTIPLIER + increment;
+
+        const uint32_t shifted  = (uint32_t)(((old >> 18) ^ old) >> 27);
+        const uint32_t rotation = (uint32_t)(old >> 59);
+
+        return (shifted >> rotation) | (shifted << ((32 - rotation) & 31));
+    }
+
+    static const uint64_t MULTIPLIER = 6364136223846793005ULL;
+
+    // SplitMix64 finalizer, so that neighbouring pixels and samples start far
+    // apart in the sequence
+    static uint64_t mix(uint64_t x)
+    {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+
+        return x ^ (x >> 31);
+    }
+
+    uint64_t state;
+    uint64_t increment;
+    const Sampler* sampler = nullptr;
+    uint32_t sampleIndex   = 0;
+    uint32_t dimension     = 0;
+    uint32_t pixelX        = 0;
+    uint32_t pixelY        = 0;
+};
@@ -8,7 +8,13 @@ struct Ray
         direction(direction),
         origin(from),
         direction_inv(1.0f / direction)
-    {}
+    {
+        // -0 has an inverse of -infinity and counts as negative
+        for (int axis = 0; axis < 3; axis++)
+        {
+            sign[axis] = direction_inv[axis] < 0.0f;
+        }
+    }
 
     Ray()
     {}
@@ -16,4 +22,5 @@ struct Ray
     glm::vec3 direction;
     glm::vec3 origin;
     glm::vec3 direction_inv;
+    unsigned  sign[3]; // 1 where the direction is negative, the index of the near box corner
 };
@@ -0,0 +1,85 @@
+#ifndef RAYPACKET_H
+#define RAYPACKET_H
+
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "Ray.hpp"
+#include "AABB.hpp"
+
+// Bundle of coherent rays traced through the trees together. Besides the rays
+// it keeps the interval of their origins and inverse directions, which bounds
+// the entry and exit distances of all of them into a box at once (Wald et al.
+// 2007). The bounds only work while every direction has the same sign on each
+// axis, a packet that breaks this is incoherent and traced ray by ray.
+class RayPacket {
+public:
+
+    // Rays per packet, the hit masks have a bit per ray
+    static const unsigned MAX_SIZE = 64;
+
+    void add(const Ray& ray);
+
+    void clear()
+    {
+        count = 0;
+    }
+
+    unsigned size() const
+    {
+        return count;
+    }
+
+    const Ray& operator[](unsigned i) const
+    {
+        return rays[i];
+    }
+
+    bool isCoherent() const
+    {
+        return coherent;
+    }
+
+    // Direction sign shared by all rays, 1 where negative
+    unsigned isNegative(int axis) const
+    {
+        return negative[axis];
+    }
+
+    // Index of the first ray from first on that enters box before its tMax, or
+    // size() when none does. The rays before the returned one can be dropped
+    // for everything inside box.
+    unsigned firstActive(const AABB & box,
+                         unsigned     first,
+                         const float* tMax) const
+    {
+        float t;
+
+        // Coherent rays mostly agree, so the first one decides most boxes
+        if ((first < count) && box.intersection(rays[first], tMax[first], t)) return first;
+
+        if ((first >= count) || misses(box)) return count;
+
+        for (unsigned i = first + 1; i < count; i++)
+        {
+            if (box.intersection(rays[i], tMax[i], t)) return i;
+        }
+
+        return count;
+    }
+
+private:
+
+    // Whether the interval bounds prove that no ray enters box
+    bool misses(const AABB& box) const;
+
+    Ray       rays[MAX_SIZE];
+    unsigned  count    = 0;
+    bool      coherent = true;
+    unsigned  negative[3];
+    glm::vec3 minOrigin, maxOrigin;
+    glm::vec3 minInvDirection, maxInvDirection;
+};
+
+#endif // RAYPACKET_H
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <ostream>
+
+// Traversal counters, compiled in with the TRACER_STATS option. Every thread
+// counts into its own copy and flushes it into the totals now and then.
+namespace RayStats {
+#ifdef TRACER_STATS
+
+struct Counters
+{
+    unsigned long long rays      = 0;
+    unsigned long long nodes     = 0;
+    unsigned long long triangles = 0;
+};
+
+extern thread_local Counters local;
+
+inline void countRay()
+{
+    local.rays++;
+}
+
+inline void countNode()
+{
+    local.nodes++;
+}
+
+inline void countTriangle()
+{
+    local.triangles++;
+}
+
+inline void countTriangles(unsigned count)
+{
+    local.triangles += count;
+}
+
+// Adds the counters of the calling thread to the totals
+void flush();
+
+void print(std::ostream& out);
+
+#else // ifdef TRACER_STATS
+
+inline void countRay()
+{}
+
+inline void countNode()
+{}
+
+inline void countTriangle()
+{}
+
+inline void countTriangles(unsigned)
+{}
+
+inline void flush()
+{}
+
+inline void print(std::ostream&)
+{}
+
+#endif // ifdef TRACER_STATS
+} // namespace RayStats
@@ -1,25 +1,102 @@
 #pragma once
 
+#include <vector>
+
 #include "Scene.h"
+#include "Random.hpp"
+
+// Path segment waiting to be traced. Its radiance reaches the pixel scaled by
+// weight. Every segment draws its samples from a generator of its own, so the
+// order segments are traced in does not change the image.
+struct PathRay
+{
+    Ray          ray;
+    glm::vec3    weight;
+    unsigned int pixel;
+    unsigned int depth;
+    Random       random;
+};
 
 class Renderer {
 public:
 
+    // Paths end at maxDepth bounces at the latest. From rouletteDepth on they
+    // are also ended at random, the more likely the less light they carry.
     Renderer(const Scene      & scene,
-             const unsigned int MAX_DEPTH = 5);
+             const unsigned int MAX_DEPTH      = 5,
+             const unsigned int ROULETTE_DEPTH = 3);
+
+    // Transparent surfaces either refract or reflect each path, picked at
+    // random by their Fresnel weights, instead of splitting it in two
+    void setFresnelSampling(bool enabled)
+    {
+        fresnelSampling = enabled;
+    }
 
-    glm::vec3 getPixelColor(const Ray& ray) const
+    // Radiance along the camera ray, with samples drawn from random
+    glm::vec3 getPixelColor(const Ray& ray, Random& random) const
     {
-        return traceRay(ray);
+        return traceRay(ray, random);
     }
 
+    // getPixelColor for every ray of packet, each with the generator of the
+    // same index. Coherent packets find their first hits together, the rest
+    // of each path is traced alone.
+    void getPixelColors(const RayPacket& packet,
+                        Random         * randoms,
+                        glm::vec3      * colors) const;
+
+    // Traces the paths starting with rays breadth first and adds their radiance
+    // to pixels. Every bounce of all paths is sorted, intersected and shaded
+    // as one batch, so neighbouring rays walk the same parts of the trees.
+    // Consumes rays.
+    void traceWavefront(std::vector<PathRay>& rays,
+                        glm::vec3           * pixels) const;
+
 private:
 
+    // Orders rays by direction octant, then by the Morton code of the origin
+    static void sortRays(std::vector<PathRay>& rays);
+
+    // Radiance along the path starting with ray, times its throughput weight.
+    // The branches of the path wait on a stack, so the call depth stays flat.
     glm::vec3 traceRay(const Ray        & ray,
-                       const unsigned int DEPTH = 0) const;
+                       const Random     & random,
+                       const unsigned int DEPTH  = 0,
+                       const glm::vec3  & WEIGHT = glm::vec3(1.0f)) const;
+
+    // Whether a path segment at depth, with throughput weight, is traced at
+    // all. Russian roulette keeps it with a probability of its largest weight
+    // component and divides weight by that, which keeps the estimate unbiased.
+    bool continuePath(unsigned int depth,
+                      glm::vec3  & weight,
+                      Random     & random) const;
+
+    // Color of the surface ray hit at the given distance. The radiance along
+    // each secondary ray comes from trace(ray, depth, weight), which returns it
+    // times weight, or 0 when it takes care of the ray later on.
+    template<typename Trace>
+    glm::vec3 shade(const Ray        & ray,
+                    unsigned int       intersectedGroupID,
+                    unsigned int       intersectedTriangleID,
+                    float              intersectedDistance,
+                    const unsigned int DEPTH,
+                    Random           & random,
+                    Trace              trace) const;
+
+    // Light reaching the diffuse surface at point from one point on all
+    // emitting surfaces, seen along ray. Estimates the mean over the emitting
+    // area, the point is picked by Scene::sampleLight and divided by its pdf.
+    glm::vec3 sampleDirectLight(const Ray      & ray,
+                                const glm::vec3& point,
+                                const glm::vec3& normal,
+                                const Material * material,
+                                Random         & random) const;
 
 private:
 
     const unsigned int maxDepth;
+    const unsigned int rouletteDepth;
+    bool fresnelSampling = false;
     const Scene& scene;
 };
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <memory>
+#include <cstdint>
+
+// Where the sample values of a path come from
+enum class SamplerType
+{
+    Random,   // Independent PCG numbers, no sampler
+    Sobol,    // Owen-scrambled Sobol points, scrambled differently in every pixel
+    Halton,   // Halton points, with digits scrambled differently in every pixel
+    BlueNoise // Owen-scrambled Sobol points shared by all pixels, shifted by a blue noise mask
+};
+
+// Low-discrepancy points for the samples of a pixel. Sample index of pixel
+// (x, y) is a point with one coordinate per dimension, which the camera, light
+// and BSDF sampling along its path take in order. Coordinates are fractions of
+// 2^32 in [0, 1).
+class Sampler {
+public:
+
+    virtual ~Sampler()
+    {}
+
+    // Null for SamplerType::Random
+    static std::shared_ptr<Sampler> create(SamplerType type);
+
+    virtual uint32_t sample(uint32_t index,
+                            uint32_t dimension,
+                            uint32_t x,
+                            uint32_t y) const = 0;
+
+    // Dimensions with a coordinate, the ones after that are drawn at random
+    virtual uint32_t getDimensions() const = 0;
+
+protected:
+
+    // Hash of value for the given seed, different for every seed
+    static uint32_t hash(uint32_t value, uint32_t seed)
+    {
+        value ^= seed * 0x9e3779b9u;
+        value ^= value >> 16;
+        value *= 0x7feb352du;
+        value ^= value >> 15;
+        value *= 0x846ca68bu;
+        value ^= value >> 16;
+
+        return value;
+    }
+};
@@ -1,6 +1,10 @@
 #pragma once
 
 #include <vector>
+#include <memory>
+#include <string>
+#include <map>
+#include <cstdint>
 #include <functional>
 
 #include <tiny_obj_loader/tiny_obj_loader.h>
@@ -8,6 +12,19 @@
 #include "Ray.hpp"
 #include "Mesh.hpp"
 #include "Triangle.h"
+#include "SceneBVH.h"
+#include "MappedFile.h"
+#include "Arena.h"
+#include "AliasTable.h"
+
+// Point on an emitting triangle, picked by Scene::sampleLight
+struct LightSample
+{
+    const Mesh* mesh;     // Render group of the triangle
+    glm::vec3   position; // In world space
+    glm::vec3   normal;   // Of the triangle at position, in world space
+    float       pdf;      // Per unit of world space area
+};
 
 class Scene {
 public:
@@ -17,14 +34,6 @@ public:
 
     ~Scene()
     {
-        for (auto& rg : renderGroups)
-        {
-            for (auto triangle : rg.triangles)
-            {
-                delete triangle;
-            }
-        }
-
         for (auto m : materials)
         {
             delete m;
@@ -33,14 +42,32 @@ public:
 
     void initialize()
     {
-        // Pre-store all emissive materials in a separate vector.
-        for (auto& rg : renderGroups)
-        {
-            if (rg.material->isEmissive())
-            {
-                emissiveMesh.push_back(&rg);
-            }
-        }
+        buildTrees();
+        saveCaches();
+        buildLightDistribution();
+
+        // Build the top level hierarchy over all render groups
+        topLevel.build(getBounds());
+    }
+
+    // Places render group renderGroupIndex in the world by modelMatrix, which
+    // applies to the space its triangles were loaded in. The render group
+    // keeps its tree, the top level hierarchy catches up on update.
+    void setTransform(unsigned         renderGroupIndex,
+                      const glm::mat4& modelMatrix)
+    {
+        renderGroups[renderGroupIndex].setTransform(modelMatrix);
+    }
+
+    // Refits the top level hierarchy to the render groups moved since
+    // initialize or the last update, between frames. Rebuilds it instead when
+    // the refit tree costs more than rebuildRatio times the built one. Returns
+    // true if it was rebuilt. The light distribution follows moved lights.
+    bool update(float rebuildRatio = TOP_LEVEL_REBUILD_RATIO);
+
+    unsigned getRenderGroupCount() const
+    {
+        return (unsigned)renderGroups.size();
     }
 
     const Mesh& getRenderGroup(unsigned renderGroupIndex) const
@@ -48,14 +75,56 @@ public:
         return renderGroups[renderGroupIndex];
     }
 
+    // In the object space of the render group
     const Triangle& getTriangle(unsigned int renderGroupIndex, unsigned int index) const
     {
-        return *(renderGroups[renderGroupIndex].triangles[index]);
+        return *(renderGroups[renderGroupIndex].geometry->triangles[index]);
+    }
+
+    // Picks an emissive triangle with a probability proportional to its
+    // emitted power times its world space area, then a point on it uniformly.
+    // False if nothing emits light.
+    bool sampleLight(Random     & random,
+                     LightSample& sample) const;
+
+    // World space area of all emissive triangles
+    float getEmissiveArea() const
+    {
+        return emissiveArea;
+    }
+
+    // Applies to trees built afterwards, by initialize. Set it before adding
+    // objects when caching, the cache of an object depends on it.
+    void setBuildOptions(const BuildOptions& options)
+    {
+        buildOptions = options;
+    }
+
+    // Objects added afterwards are loaded from a cache in directory when it
+    // has one for them, and cached there by initialize otherwise. An empty
+    // directory turns caching off.
+    void setCacheDirectory(const std::string& directory)
+    {
+        cacheDirectory = directory;
+    }
+
+    // Backs the triangles of meshes added afterwards by transparent huge pages
+    // where the system supports them
+    void setHugePages(bool enable)
+    {
+        arena.setHugePages(enable);
     }
 
-    const std::vector<Mesh *>& getEmissiveMeshes() const
+    // Accumulated build quality of all mesh trees
+    const TreeStats& getTreeStats() const
     {
-        return emissiveMesh;
+        return treeStats;
+    }
+
+    // Wall time spent building the mesh trees, in milliseconds
+    long long getBuildTime() const
+    {
+        return buildTime;
     }
 
     // Casts a ray through the scene. Save the closest intersection.
@@ -64,17 +133,31 @@ public:
                  unsigned int& intersectionTriangleIndex,
                  float       & intersectionDistance) const;
 
-    // Casts a ray through a given render group
+    // rayCast for every ray of a coherent packet, the results are indexed like
+    // the rays. Returns a mask of the rays that hit something.
+    uint64_t rayCastPacket(const RayPacket& packet,
+                           unsigned int   * intersectionRenderGroupIndices,
+                           unsigned int   * intersectionTriangleIndices,
+                           float          * intersectionDistances) const;
+
+    // Whether anything blocks ray before tMax. Stops at the first blocker found.
+    bool occluded(const Ray& ray,
+                  float      tMax) const;
+
+    // Casts a ray through a given render group, using its tree
     // Returns true if there was an intersection
     bool renderGroupRayCast(const Ray   & ray,
                             unsigned int  renderGroupIndex,
                             unsigned int& intersectedTriangleID,
                             float       & intersectedDistance) const;
 
-    void addObj(std::string filePath,
-                glm::vec3   translate = glm::vec3(),
-                glm::vec3   rotate    = glm::vec3(),
-                glm::vec3   scale     = glm::vec3(1.0f));
+    // Every file is loaded once, adding it again places another instance of
+    // its meshes that shares their triangles and trees. Returns the index of
+    // the first render group added, the others follow it.
+    unsigned addObj(std::string filePath,
+                    glm::vec3   translate = glm::vec3(),
+                    glm::vec3   rotate    = glm::vec3(),
+                    glm::vec3   scale     = glm::vec3(1.0f));
 
     void addMesh(const tinyobj::attrib_t               & attrib,
                  const tinyobj::mesh_t                 & mesh,
@@ -83,7 +166,63 @@ public:
 
 private:
 
+    // Cost increase of the refit top level hierarchy that makes update rebuild it
+    static constexpr float TOP_LEVEL_REBUILD_RATIO = 1.5f;
+
+    // World space boxes of all render groups, by index
+    std::vector<AABB> getBounds() const;
+
+    // Meshes of an OBJ file in its object space, from the cache if there is one
+    std::vector<Mesh> loadObj(const std::string& filePath);
+
+    Mesh loadMesh(const tinyobj::attrib_t               & attrib,
+                  const tinyobj::mesh_t                 & mesh,
+                  const std::vector<tinyobj::material_t>& materials,
+                  const glm::mat4                       & modelMatrix);
+
+    // Builds the trees of all meshes that have none yet, in parallel
+    void buildTrees();
+
+    // Collects the emissive triangles of all render groups, weighted by power
+    // times area in their current place
+    void buildLightDistribution();
+
+    // Reads the meshes of the cache for key. False if there is no valid one.
+    bool loadCache(uint64_t           key,
+                   std::vector<Mesh>& meshes);
+
+    // Writes the caches of the objects added since the last call
+    void saveCaches();
+
+    // Meshes loaded from an object whose cache has to be written
+    struct PendingCache
+    {
+        uint64_t          key;
+        std::vector<Mesh> meshes;
+    };
+
+    // Emissive triangle, pdf is the area density of sampleLight on it
+    struct EmissiveTriangle
+    {
+        unsigned renderGroupIndex;
+        unsigned index;
+        float    pdf;
+    };
+
+    // Declared first so that it outlives everything pointing into it
+    Arena arena;
     std::vector<Mesh>renderGroups;
+    std::map<std::string, std::vector<Mesh> >objects;
     std::vector<Material *>materials;
-    std::vector<Mesh *>emissiveMesh;
+    // Sampled through lightTable, which has the same order
+    std::vector<EmissiveTriangle>emissiveTriangles;
+    AliasTable lightTable;
+    float emissiveArea = 0.0f;
+    SceneBVH topLevel;
+    BuildOptions buildOptions;
+    TreeStats treeStats;
+    long long buildTime = 0;
+    std::string cacheDirectory;
+    std::vector<PendingCache>pendingCaches;
+    std::vector<std::unique_ptr<MappedFile> >mappedCaches;
 };
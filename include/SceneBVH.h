@@ -0,0 +1,163 @@
+#ifndef SCENEBVH_H
+#define SCENEBVH_H
+
+#include <vector>
+
+#include "Ray.hpp"
+#include "AABB.hpp"
+#include "RayPacket.h"
+
+// Top level hierarchy over the bounds of the render groups in a scene.
+// Every leaf holds exactly one render group.
+class SceneBVH {
+public:
+
+    void build(const std::vector<AABB>& bounds);
+
+    // Fits the node boxes to new bounds of the same render groups, keeping the
+    // tree as it is. Each level is refit in parallel, deepest first. Returns
+    // the cost of the tree relative to its cost when it was built.
+    float refit(const std::vector<AABB>& bounds);
+
+    // Summed area of all node boxes relative to that of the leaf boxes. Moving
+    // leaves apart without changing the tree makes the inner boxes, and the
+    // cost, grow. Unlike a cost relative to the root box it stays comparable
+    // when the whole scene grows or shrinks.
+    float getCost() const;
+
+    // Visits the leaves hit by ray front to back. visit(index, tMax) is called
+    // for each render group and may shrink tMax to the closest hit so far, which
+    // culls every node entered further away. Returning true stops the traversal.
+    template<typename Visitor>
+    void traverse(const Ray& ray, float& tMax, Visitor visit) const
+    {
+        struct Entry
+        {
+            unsigned node;
+            float    t;
+        };
+
+        Entry stack[MAX_DEPTH];
+        int   stackSize = 0;
+        float t;
+
+        if (nodes.empty() || !nodes[0].box.intersection(ray, tMax, t))
+        {
+            return;
+        }
+
+        stack[stackSize++] = { 0, t };
+
+        while (stackSize > 0)
+        {
+            const Entry entry = stack[--stackSize];
+
+            if (entry.t > tMax) continue;
+
+            const Node& node = nodes[entry.node];
+
+            if (node.leaf)
+            {
+                if (visit(node.offset, tMax)) return;
+
+                continue;
+            }
+
+            float tLeft, tRight;
+            bool  hitLeft  = nodes[node.offset].box.intersection(ray, tMax, tLeft);
+            bool  hitRight = nodes[node.offset + 1].box.intersection(ray, tMax, tRight);
+
+            // Push the far child first so the near one is popped next
+            if (hitLeft && hitRight)
+            {
+                if (tLeft < tRight)
+                {
+                    stack[stackSize++] = { node.offset + 1, tRight };
+                    stack[stackSize++] = { node.offset, tLeft };
+                }
+                else
+                {
+                    stack[stackSize++] = { node.offset, tLeft };
+                    stack[stackSize++] = { node.offset + 1, tRight };
+                }
+            }
+            else if (hitLeft)
+            {
+                stack[stackSize++] = { node.offset, tLeft };
+            }
+            else if (hitRight)
+            {
+                stack[stackSize++] = { node.offset + 1, tRight };
+            }
+        }
+    }
+
+    // Visits the leaves entered by any ray of a coherent packet, roughly front
+    // to back. visit(index, first) is called for each render group with the
+    // first ray that enters it, and may shrink the tMax of the rays.
+    template<typename Visitor>
+    void traversePacket(const RayPacket& packet, const float* tMax, Visitor visit) const
+    {
+        struct Entry
+        {
+            unsigned node;
+            unsigned first;
+        };
+
+        Entry stack[MAX_DEPTH + 1];
+        int   stackSize = 0;
+
+        if (nodes.empty()) return;
+
+        stack[stackSize++] = { 0, 0 };
+
+        while (stackSize > 0)
+        {
+            const Entry    entry  = stack[--stackSize];
+            const Node   & node   = nodes[entry.node];
+            const unsigned active = packet.firstActive(node.box, entry.first, tMax);
+
+            if (active == packet.size()) continue;
+
+            if (node.leaf)
+            {
+                visit(node.offset, active);
+
+                continue;
+            }
+
+            // The child whose center lies further along the rays is the far one
+            const glm::vec3 separation = nodes[node.offset + 1].box.getCenter() -
+                                         nodes[node.offset].box.getCenter();
+            const unsigned  near       = node.offset +
+                                         (glm::dot(separation, packet[active].direction) < 0.0f);
+
+            stack[stackSize++] = { 2 * node.offset + 1 - near, active };
+            stack[stackSize++] = { near, active };
+        }
+    }
+
+private:
+
+    static const int MAX_DEPTH = 64;
+
+    struct Node
+    {
+        AABB     box;
+        unsigned offset; // Leaf: render group index. Inner: left child, right is next to it
+        bool     leaf;
+    };
+
+    void buildNode(unsigned                 nodeIndex,
+                   std::vector<unsigned>  & items,
+                   size_t                   begin,
+                   size_t                   end,
+                   const std::vector<AABB>& bounds,
+                   int                      depth);
+
+    std::vector<Node>nodes;
+    std::vector<std::vector<unsigned> >levels; // Node indices by depth
+    float buildCost = 0.0f;
+};
+
+#endif // SCENEBVH_H
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "Accelerator.h"
+
+// Binary cache of the meshes loaded from one OBJ file: their materials, the
+// triangles in object space and, for the binary BVH, the flattened tree. The file
+// is mapped and used in place, so it is only valid for the build that wrote
+// it. The header records the format version and the sizes of stored types.
+namespace SceneCache {
+const uint32_t VERSION = 2;
+
+struct Header
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t meshCount;
+    uint64_t key;
+    uint32_t triangleSize;
+    uint32_t nodeSize;
+    uint32_t packetSize;
+    uint32_t padding;
+};
+
+// Follows the header once per mesh. Offsets are from the start of the file.
+struct MeshRecord
+{
+    float    color[3];
+    float    emissivity;
+    float    reflectivity;
+    float    transparency;
+    float    refractiveIndex;
+    float    specularity;
+    float    specularExponent;
+    float    boxMin[3];
+    float    boxMax[3];
+    uint64_t triangleOffset;
+    uint64_t triangleCount;
+    uint64_t nodeOffset;
+    uint64_t nodeCount; // 0 when the tree is not stored and has to be built
+    uint64_t packetOffset;
+    uint64_t packetCount;
+};
+
+// Hash of everything the meshes of an OBJ file depend on: its contents, those
+// of its material libraries and the build options. 0 if the file cannot be
+// read.
+uint64_t computeKey(const std::string & objPath,
+                    const BuildOptions& options);
+
+std::string fileName(const std::string& directory,
+                     uint64_t           key);
+
+// The header if data is a complete cache for key, nullptr otherwise
+const Header* validate(const char* data,
+                       size_t      size,
+                       uint64_t    key);
+
+// Appends size bytes at the next 64 byte boundary and returns their offset
+uint64_t append(std::vector<char>& buffer,
+                const void       * data,
+                size_t             size);
+
+// Writes buffer, which starts with its header, under a temporary name and
+// renames it, so other processes never map a partial file. Also succeeds when
+// a complete cache for the same key is in the way of the rename.
+bool write(const std::string      & path,
+           const std::vector<char>& buffer);
+} // namespace SceneCache
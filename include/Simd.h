@@ -0,0 +1,35 @@
+#pragma once
+
+// Ray data laid out for the SIMD kernels. The AVX2 kernels are compiled in a
+// translation unit of their own with AVX2 enabled and are only called when the
+// CPU supports it, so they must not share inline code with the rest.
+struct SimdRay
+{
+    float origin[3];
+    float direction[3];
+    float invDirection[3];
+    int   sign[3]; // 1 where the inverse direction is negative, selects the near box plane
+};
+
+namespace Simd {
+// Floats in a TrianglePacket: v0, e1 and e2 as [axis][triangle], then the ids
+const int TRIANGLE_PACKET_FLOATS = 40;
+
+// Whether the CPU and OS support AVX2
+bool hasAVX2();
+
+// Tests ray against the 8 boxes of bounds, laid out as [min, max][axis][box].
+// Returns a mask of the boxes entered before tMax and their entry distances.
+int intersectBoxes8AVX2(const float  * bounds,
+                        const SimdRay& ray,
+                        float          tMax,
+                        float        * tEntry);
+
+// Tests ray against the triangles of count consecutive packets, 8 at a time.
+// Returns the position of the closest hit before tMax, which is moved to the
+// hit, or -1 when there is none.
+int intersectTriangles8AVX2(const float  * packets,
+                            unsigned       count,
+                            const SimdRay& ray,
+                            float        & tMax);
+} // namespace Simd
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Sampler.h"
+
+// Sobol points with hash-based Owen scrambling (Burley 2020). Only the first
+// two Sobol dimensions are used, which are a (0, 2)-sequence: any power of two
+// samples are stratified in every 2D projection of the pair. Every further pair
+// of dimensions takes them again with the sample order shuffled by a scramble
+// of its own, so there is no limit on the dimensions and the pairs are
+// independent of each other.
+class SobolSampler : public Sampler {
+public:
+
+    // Pixels get scrambles derived from seed, or all the same one with
+    // perPixel off
+    explicit SobolSampler(uint32_t seed     = 0,
+                          bool     perPixel = true);
+
+    uint32_t sample(uint32_t index,
+                    uint32_t dimension,
+                    uint32_t x,
+                    uint32_t y) const override;
+
+    uint32_t getDimensions() const override
+    {
+        return UINT32_MAX;
+    }
+
+private:
+
+    static const int SOBOL_DIMENSIONS = 2;
+
+    // Unscrambled coordinate of point index
+    uint32_t sobol(uint32_t index,
+                   int      dimension) const;
+
+    // Owen scrambling of the bits of value, most significant first
+    static uint32_t nestedUniformScramble(uint32_t value,
+                                          uint32_t seed);
+
+    uint32_t seed;
+    bool     perPixel;
+    uint32_t directions[SOBOL_DIMENSIONS][32];
+};
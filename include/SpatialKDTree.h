@@ -0,0 +1,92 @@
+#ifndef SPATIALKDTREE_H
+#define SPATIALKDTREE_H
+
+#include <vector>
+
+#include "Triangle.h"
+#include "Ray.hpp"
+#include "AABB.hpp"
+#include "Accelerator.h"
+#include "TrianglePackets.h"
+
+// Node of the spatial kd-tree, 8 bytes. The below child of an inner node
+// directly follows it, the above child is stored at an explicit index.
+struct SplitNode
+{
+    union
+    {
+        float    split;  // Inner: split plane position
+        unsigned offset; // Leaf: first triangle packet
+    };
+
+    unsigned flags; // Low 2 bits: split axis, 3 for a leaf. Rest: above child or triangle count
+
+    bool isLeaf() const
+    {
+        return (flags & 3) == 3;
+    }
+
+    unsigned axis() const
+    {
+        return flags & 3;
+    }
+
+    unsigned data() const
+    {
+        return flags >> 2;
+    }
+};
+
+// Kd-tree whose split planes cut space instead of the triangle set. A triangle
+// crossing a plane is referenced from both sides and clipped to each of them,
+// so cells never overlap and are traversed strictly front to back.
+class SpatialKDTree : public Accelerator {
+public:
+
+    static const int MAX_DEPTH = 64;
+
+    SpatialKDTree(const std::vector<Triangle *>& tris);
+
+    bool hit(const Ray& ray,
+             float    & tmin,
+             long     & tri_idx) const override;
+
+    bool occluded(const Ray& ray,
+                  float      tMax) const override;
+
+    TreeStats getStats() const override;
+
+private:
+
+    // Triangle referenced from a node, with its bounds clipped to that node
+    struct Reference
+    {
+        const Triangle* triangle;
+        AABB            box;
+    };
+
+    void buildNode(std::vector<Reference>& refs,
+                   const AABB            & box,
+                   int                     depth,
+                   int                     maxDepth);
+
+    void makeLeaf(unsigned                      nodeIndex,
+                  const std::vector<Reference>& refs);
+
+    template<bool AnyHit>
+    bool traverse(const Ray& ray,
+                  float    & tmin,
+                  long     & tri_idx) const;
+
+    void collectStats(TreeStats & stats,
+                      unsigned    nodeIndex,
+                      const AABB& box,
+                      int         depth,
+                      float       invRootArea) const;
+
+    std::vector<SplitNode>nodes;
+    TrianglePackets packets;
+    AABB bounds;
+};
+
+#endif // SPATIALKDTREE_H
@@ -49,9 +49,9 @@ public:
         return (vertices[0] + vertices[1] + vertices[2]) / 3.0f;
     }
 
-    glm::vec3 getRandomPositionOnSurface() const;
+    glm::vec3 getRandomPositionOnSurface(Random& random) const;
 
-    AABB      getBoundingBox()
+    AABB      getBoundingBox() const
     {
         glm::vec3 bl = glm::vec3(
             std::min(std::min(vertices[0].x, vertices[1].x), vertices[2].x),
@@ -68,6 +68,38 @@ public:
     bool rayIntersection(const Ray& ray,
                          float    & intersectionDistance) const;
 
+    // Moller-Trumbore test against the triangle at v0 spanned by e1 and e2
+    static bool intersect(const Ray      & ray,
+                          const glm::vec3& v0,
+                          const glm::vec3& e1,
+                          const glm::vec3& e2,
+                          float          & intersectionDistance)
+    {
+        // Calculate intersection using barycentric coordinates
+        // This gives a equation system which we can solve using Cramer's rule
+        const glm::vec3 P       = glm::cross(ray.direction, e2);
+        const glm::vec3 T       = ray.origin - v0;
+        const float     inv_den = 1.0f / glm::dot(e1, P);
+        const float     u       = inv_den * glm::dot(T, P);
+
+        if ((u < 0.0f) || (u > 1.0f))
+        {
+            return false;
+        }
+
+        const glm::vec3 Q = glm::cross(T, e1);
+        const float     v = inv_den * glm::dot(ray.direction, Q);
+
+        if ((v < 0.0f) || (u + v > 1.0f))
+        {
+            return false;
+        }
+
+        intersectionDistance = inv_den * glm::dot(e2, Q);
+
+        return intersectionDistance > std::numeric_limits<float>::min();
+    }
+
 public:
 
     bool enabled = true;
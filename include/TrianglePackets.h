@@ -0,0 +1,77 @@
+#ifndef TRIANGLEPACKETS_H
+#define TRIANGLEPACKETS_H
+
+#include <vector>
+
+#include "Triangle.h"
+#include "Ray.hpp"
+#include "AlignedAllocator.hpp"
+#include "ArrayView.hpp"
+
+// Intersection data of up to 4 triangles as structure of arrays, one float per
+// triangle in each row. Unused slots have the id -1 and NaN vertices, which
+// never pass the hit tests.
+struct alignas(16) TrianglePacket
+{
+    float v0[3][4]; // [axis][triangle]
+    float e1[3][4];
+    float e2[3][4];
+    int   id[4];    // Mesh index of the triangle
+};
+
+// Leaf triangles of a tree in the order the traversal reads them. Every leaf
+// starts a new packet, so its triangles are contiguous and share cache lines
+// with nothing else. Normals and the rest of the shading data stay with the
+// mesh triangles and are only looked up for the closest hit.
+class TrianglePackets {
+public:
+
+    TrianglePackets()
+    {}
+
+    // Packets owned by someone else, e.g. a mapped cache file
+    explicit TrianglePackets(ArrayView<TrianglePacket> mapped)
+        : packets(mapped)
+    {}
+
+    // The view would still point into the packets of the original
+    TrianglePackets(const TrianglePackets&) = delete;
+    TrianglePackets& operator=(const TrianglePackets&) = delete;
+
+    // Appends the packets of one leaf and returns the index of the first
+    unsigned add(const Triangle *const * tris,
+                 size_t                  count);
+
+    // Tests ray against count triangles starting at packet first, a whole
+    // packet at a time. On a hit closer than tmin, moves tmin to it and sets
+    // id to the mesh index of the triangle.
+    bool intersect(const Ray& ray,
+                   unsigned   first,
+                   unsigned   count,
+                   float    & tmin,
+                   long     & id) const;
+
+    // Same tests for an any hit query, returns at the first packet with a hit
+    // closer than tMax
+    bool occluded(const Ray& ray,
+                  unsigned   first,
+                  unsigned   count,
+                  float      tMax) const;
+
+    size_t size() const
+    {
+        return packets.size();
+    }
+
+    ArrayView<TrianglePacket> getPackets() const
+    {
+        return packets;
+    }
+
+private:
+
+    std::vector<TrianglePacket, AlignedAllocator<TrianglePacket> >storage;
+    ArrayView<TrianglePacket> packets;
+};
+
+#endif // TRIANGLEPACKETS_H
@@ -0,0 +1,58 @@
+#ifndef WIDEBVH_H
+#define WIDEBVH_H
+
+#include <vector>
+
+#include "Triangle.h"
+#include "Ray.hpp"
+#include "AlignedAllocator.hpp"
+#include "Accelerator.h"
+#include "KDTree.h"
+#include "TrianglePackets.h"
+
+// Node with N children whose boxes are stored as structure of arrays, so that
+// one SIMD operation tests the ray against all of them
+template<int N>
+struct alignas(64) WideNode
+{
+    float    bounds[2][3][N]; // [min, max][axis][child], empty slots never hit
+    int      child[N];        // Inner child: node index. Leaf child: first triangle packet
+    unsigned count[N];        // Leaf child: triangle count. Inner child: 0
+};
+
+// BVH with 4 or 8 children per node, collapsed from the binary SAH tree
+template<int N>
+class WideBVH : public Accelerator {
+public:
+
+    WideBVH(const std::vector<Triangle *>& tris,
+            const BuildOptions           & options = BuildOptions());
+
+    bool hit(const Ray& ray,
+             float    & tmin,
+             long     & tri_idx) const override;
+
+    bool occluded(const Ray& ray,
+                  float      tMax) const override;
+
+    TreeStats getStats() const override;
+
+private:
+
+    template<bool AnyHit>
+    bool traverse(const Ray& ray,
+                  float    & tmin,
+                  long     & tri_idx) const;
+
+    int  collapse(const KDNode* node);
+
+    void collectStats(TreeStats& stats,
+                      int        nodeIndex,
+                      int        depth,
+                      float      invRootArea) const;
+
+    std::vector<WideNode<N>, AlignedAllocator<WideNode<N> > >nodes;
+    TrianglePackets packets;
+};
+
+#endif // WIDEBVH_H
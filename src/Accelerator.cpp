@@ -0,0 +1,99 @@
+#include <iomanip>
+#include <algorithm>
+
+#include "Accelerator.h"
+#include "KDTree.h"
+#include "WideBVH.h"
+#include "SpatialKDTree.h"
+
+std::shared_ptr<Accelerator> Accelerator::build(const std::vector<Triangle *>& tris,
+                                                const BuildOptions           & options)
+{
+    if (options.partitioning == Partitioning::Spatial)
+    {
+        return std::make_shared<SpatialKDTree>(tris);
+    }
+
+    switch (options.width)
+    {
+    case 4:
+        return std::make_shared<WideBVH<4> >(tris, options);
+
+    case 8:
+        return std::make_shared<WideBVH<8> >(tris, options);
+
+    default:
+        return std::make_shared<KDTree>(tris, options);
+    }
+}
+
+uint64_t Accelerator::hitPacket(const RayPacket& packet, unsigned first, float* tmin, long* tri_idx) const
+{
+    uint64_t hits = 0;
+
+    for (unsigned i = first; i < packet.size(); i++)
+    {
+        if (hit(packet[i], tmin[i], tri_idx[i]))
+        {
+            hits |= (uint64_t)1 << i;
+        }
+    }
+
+    return hits;
+}
+
+void TreeStats::addLeaf(long size, float area, int depth)
+{
+    nodes++;
+    leaves++;
+    references += size;
+    maxDepth    = std::max(maxDepth, depth);
+    sahCost    += SAH_INTERSECTION_COST * area * size;
+    leafSizes[std::min<long>(size, LEAF_HISTOGRAM_SIZE - 1)]++;
+}
+
+void TreeStats::addInner(float area, int depth)
+{
+    nodes++;
+    maxDepth = std::max(maxDepth, depth);
+    sahCost += SAH_TRAVERSAL_COST * area;
+}
+
+void TreeStats::add(const TreeStats& other)
+{
+    nodes      += other.nodes;
+    leaves     += other.leaves;
+    references += other.references;
+    maxDepth    = std::max(maxDepth, other.maxDepth);
+    sahCost    += other.sahCost;
+
+    for (int i = 0; i < LEAF_HISTOGRAM_SIZE; i++)
+    {
+        leafSizes[i] += other.leafSizes[i];
+    }
+}
+
+void TreeStats::print(std::ostream& out) const
+{
+    const std::ios::fmtflags flags     = out.flags();
+    const std::streamsize    precision = out.precision();
+
+    out << "Nodes: " << nodes << ", leaves: " << leaves
+        << ", triangle references: " << references
+        << ", max depth: " << maxDepth
+        << ", SAH cost: " << std::fixed << std::setprecision(2) << sahCost << std::endl;
+
+    out.flags(flags);
+    out.precision(precision);
+
+    out << "Leaf sizes:";
+
+    for (int i = 0; i < LEAF_HISTOGRAM_SIZE; i++)
+    {
+        if (leafSizes[i] == 0) continue;
+
+        out << " " << i << (i == LEAF_HISTOGRAM_SIZE - 1 ? "+" : "") << ":" << leafSizes[i];
+    }
+
+    out << std::endl;
+}
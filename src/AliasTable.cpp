@@ -0,0 +1,64 @@
+#include "AliasTable.h"
+
+#include <cassert>
+#include <algorithm>
+
+AliasTable::AliasTable(const std::vector<float>& weights)
+    : columns(weights.size())
+{
+    double total = 0.0;
+
+    for (float w : weights)
+    {
+        total += std::max(w, 0.0f);
+    }
+
+    assert(total > 0.0);
+
+    // Weights scaled so that a column holds 1, split into the entries that
+    // fill less than their column and the ones that spill over
+    const double          scale = weights.size() / total;
+    std::vector<double>   scaled(weights.size());
+    std::vector<unsigned> small, large;
+
+    for (unsigned i = 0; i < weights.size(); i++)
+    {
+        const double w = std::max(weights[i], 0.0f);
+
+        scaled[i]              = w * scale;
+        columns[i].probability = (float)(w / total);
+        columns[i].alias       = i;
+
+        (scaled[i] < 1.0 ? small : large).push_back(i);
+    }
+
+    // Every small entry is topped up from a large one, which may turn small
+    while (!small.empty() && !large.empty())
+    {
+        const unsigned less = small.back();
+        const unsigned more = large.back();
+
+        small.pop_back();
+
+        columns[less].threshold = (float)scaled[less];
+        columns[less].alias     = more;
+        scaled[more]           -= 1.0 - scaled[less];
+
+        if (scaled[more] < 1.0)
+        {
+            large.pop_back();
+            small.push_back(more);
+        }
+    }
+
+    // Whatever is left fills its column up to rounding
+    for (unsigned i : small)
+    {
+        columns[i].threshold = 1.0f;
+    }
+
+    for (unsigned i : large)
+    {
+        columns[i].threshold = 1.0f;
+    }
+}
@@ -0,0 +1,151 @@
+#include "Arena.h"
+
+#include <cstdint>
+#include <algorithm>
+
+#include <xmmintrin.h>
+
+#ifdef _OPENMP
+# include <omp.h>
+#endif
+
+#ifdef __linux__
+# include <sys/mman.h>
+#endif
+
+static const size_t CACHE_LINE = 64;
+
+// Transparent huge pages are this large on x86-64
+static const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+// Bytes to skip from p to the next multiple of alignment
+static size_t padding(const char* p, size_t alignment)
+{
+    return (alignment - (uintptr_t)p % alignment) % alignment;
+}
+
+Arena::Arena(size_t blockSize)
+    : blockSize(blockSize)
+{
+#ifdef _OPENMP
+    // Inside a parallel region the team may be larger than the next one
+    cursors.resize(std::max(omp_get_max_threads(), omp_get_num_threads()));
+#endif
+}
+
+Arena::~Arena()
+{
+    for (const Block& block : blocks)
+    {
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        if (block.huge)
+        {
+            munmap(block.data, block.size);
+
+            continue;
+        }
+#endif
+        _mm_free(block.data);
+    }
+}
+
+void Arena::setHugePages(bool enable)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    hugePages = enable;
+}
+
+void* Arena::allocate(size_t size, size_t alignment)
+{
+    std::unique_lock<std::mutex> guard(lock, std::defer_lock);
+
+    // Large arrays get a block of their own, leaving the current ones in use
+    if (size + alignment > blockSize / 2)
+    {
+        guard.lock();
+
+        const Block& block = addBlock(size + alignment);
+
+        return block.data + padding(block.data, alignment);
+    }
+
+    Cursor* cursor = threadCursor();
+
+    if (!cursor)
+    {
+        guard.lock();
+        cursor = &shared;
+    }
+
+    if (!cursor->next || ((size_t)(cursor->end - cursor->next) < padding(cursor->next, alignment) + size))
+    {
+        if (!guard.owns_lock()) guard.lock();
+
+        const Block& block = addBlock(blockSize);
+
+        cursor->next = block.data;
+        cursor->end  = block.data + block.size;
+    }
+
+    char* aligned = cursor->next + padding(cursor->next, alignment);
+
+    cursor->next = aligned + size;
+
+    return aligned;
+}
+
+Arena::Cursor* Arena::threadCursor()
+{
+#ifdef _OPENMP
+    // Thread numbers are only unique within the outermost team, a nested team
+    // numbers its threads from 0 again
+    if (omp_get_level() > 1) return nullptr;
+
+    const size_t thread = omp_get_thread_num();
+
+    return thread < cursors.size() ? &cursors[thread] : nullptr;
+#else
+    return nullptr;
+#endif
+}
+
+const Arena::Block& Arena::addBlock(size_t minSize)
+{
+    Block block = { nullptr, std::max(blockSize, minSize), false };
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (hugePages)
+    {
+        // Whole huge pages, starting on a huge page boundary
+        const size_t size = (block.size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        void       * p    = mmap(nullptr, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (p != MAP_FAILED)
+        {
+            char*        start = static_cast<char *>(p);
+            const size_t head  = padding(start, HUGE_PAGE_SIZE);
+
+            if (head > 0) munmap(start, head);
+
+            munmap(start + head + size, HUGE_PAGE_SIZE - head);
+            madvise(start + head, size, MADV_HUGEPAGE);
+
+            block = { start + head, size, true };
+        }
+    }
+#endif
+
+    if (!block.data)
+    {
+        block.data = static_cast<char *>(_mm_malloc(block.size, CACHE_LINE));
+
+        if (!block.data) throw std::bad_alloc();
+    }
+
+    blocks.push_back(block);
+    reserved += block.size;
+
+    return blocks.back();
+}
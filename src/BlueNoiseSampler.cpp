@@ -0,0 +1,153 @@
+#include "BlueNoiseSampler.h"
+
+#include <cmath>
+#include <algorithm>
+
+#include "Random.hpp"
+
+// Width of the Gaussian filter the void-and-cluster method measures clusters
+// and voids with, in texels
+static const float CLUSTER_SIGMA = 1.5f;
+
+BlueNoiseSampler::BlueNoiseSampler(uint32_t seed)
+    : sobol(seed, false)
+{
+    buildMask(seed);
+}
+
+uint32_t BlueNoiseSampler::sample(uint32_t index, uint32_t dimension, uint32_t x, uint32_t y) const
+{
+    const uint32_t offset = hash(dimension, 0);
+    const uint32_t maskX  = (x + (offset & 0xffff)) % MASK_SIZE;
+    const uint32_t maskY  = (y + (offset >> 16)) % MASK_SIZE;
+
+    // The shift wraps around with the unsigned sum
+    return sobol.sample(index, dimension, 0, 0) + mask[maskY * MASK_SIZE + maskX];
+}
+
+void BlueNoiseSampler::buildMask(uint32_t seed)
+{
+    const int AREA = MASK_SIZE * MASK_SIZE;
+
+    // Filter weight by offset, wrapping around the mask
+    std::vector<float> kernel(AREA);
+
+    for (int dy = 0; dy < MASK_SIZE; dy++)
+    {
+        for (int dx = 0; dx < MASK_SIZE; dx++)
+        {
+            const float x = (float)std::min(dx, MASK_SIZE - dx);
+            const float y = (float)std::min(dy, MASK_SIZE - dy);
+
+            kernel[dy * MASK_SIZE + dx] = std::exp(-(x * x + y * y) / (2.0f * CLUSTER_SIGMA * CLUSTER_SIGMA));
+        }
+    }
+
+    // Filtered pattern of set texels
+    std::vector<float> energy(AREA, 0.0f);
+    std::vector<char>  pattern(AREA, 0);
+
+    const auto toggle = [&](int texel) {
+            const int   px   = texel % MASK_SIZE;
+            const int   py   = texel / MASK_SIZE;
+            const float sign = pattern[texel] ? -1.0f : 1.0f;
+
+            pattern[texel] = !pattern[texel];
+
+            for (int qy = 0; qy < MASK_SIZE; qy++)
+            {
+                const float* row = &kernel[((qy - py + MASK_SIZE) % MASK_SIZE) * MASK_SIZE];
+
+                for (int qx = 0; qx < MASK_SIZE; qx++)
+                {
+                    energy[qy * MASK_SIZE + qx] += sign * row[(qx - px + MASK_SIZE) % MASK_SIZE];
+                }
+            }
+        };
+
+    // The tightest cluster is the set texel with the most energy, the largest
+    // void the unset texel with the least
+    const auto tightestCluster = [&]() {
+            int best = -1;
+
+            for (int texel = 0; texel < AREA; texel++)
+            {
+                if (pattern[texel] && ((best < 0) || (energy[texel] > energy[best]))) best = texel;
+            }
+
+            return best;
+        };
+
+    const auto largestVoid = [&]() {
+            int best = -1;
+
+            for (int texel = 0; texel < AREA; texel++)
+            {
+                if (!pattern[texel] && ((best < 0) || (energy[texel] < energy[best]))) best = texel;
+            }
+
+            return best;
+        };
+
+    // A tenth of the texels set at random
+    Random random(seed);
+    int    count = 0;
+
+    while (count < AREA / 10)
+    {
+        const int texel = random.nextUInt() % AREA;
+
+        if (pattern[texel]) continue;
+
+        toggle(texel);
+        count++;
+    }
+
+    // Move the tightest cluster into the largest void until it is the same texel
+    for (int i = 0; i < AREA; i++)
+    {
+        const int cluster = tightestCluster();
+
+        toggle(cluster);
+
+        const int hole = largestVoid();
+
+        toggle(hole);
+
+        if (hole == cluster) break;
+    }
+
+    const std::vector<char>  initialPattern = pattern;
+    const std::vector<float> initialEnergy  = energy;
+    std::vector<int> rank(AREA);
+
+    // Ranks below the initial count by taking clusters away
+    for (int r = count - 1; r >= 0; r--)
+    {
+        const int cluster = tightestCluster();
+
+        toggle(cluster);
+        rank[cluster] = r;
+    }
+
+    pattern = initialPattern;
+    energy  = initialEnergy;
+
+    // Ranks above by filling voids. Past half of the texels this is also the
+    // tightest cluster of the unset ones, as the energies of set and unset
+    // texels add up to the same everywhere.
+    for (int r = count; r < AREA; r++)
+    {
+        const int hole = largestVoid();
+
+        toggle(hole);
+        rank[hole] = r;
+    }
+
+    mask.resize(AREA);
+
+    for (int texel = 0; texel < AREA; texel++)
+    {
+        mask[texel] = (uint32_t)((((uint64_t)(2 * rank[texel] + 1)) << 32) / (2 * AREA));
+    }
+}
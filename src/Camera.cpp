@@ -2,16 +2,21 @@
 
 #include <iostream>
 #include <fstream>
-#include <random>
 #include <algorithm>
 #include <iomanip>
+#include <functional>
 
 #include "Ray.hpp"
+#include "RayPacket.h"
 #include "Math.hpp"
+#include "RayStats.h"
 
 static const double LOG_INTERVAL = 1.0;
 static const float  GAMMA        = 0.6f;
 
+// Camera rays per wavefront, at least one column
+static const size_t WAVEFRONT_RAYS = 1 << 20;
+
 inline HumanTime toHumanTime(long long time)
 {
     return HumanTime{ ((time / 60) / 60), (time / 60) % 60, time % 60 };
@@ -49,66 +54,129 @@ HumanTime Camera::render(const Scene& scene,
     glm::vec3  c4        = center + right + up;
     const auto startTime = std::chrono::high_resolution_clock::now();
 
-    // Initialize the random engine
-    std::random_device rd;
-    std::default_random_engine gen(rd());
-    std::uniform_real_distribution<float> rand(0, 1.0f - std::numeric_limits<float>::min());
-
     // Precompute inverse widths and heights
     const float invWidth  = 1.0f / static_cast<float>(width);
     const float invHeight = 1.0f / static_cast<float>(height);
     const float invSample = 1.0f / static_cast<float>(samplePerPixel);
 
-    // Calculate step lengths
-    const float sqrtSamplePerPixel    = sqrtf(static_cast<float>(samplePerPixel));
-    const float invSqrtSamplePerPixel = 1.0f / sqrtSamplePerPixel;
-    const float columnStep            = invWidth * invSqrtSamplePerPixel;
-    const float rowStep               = invHeight * invSqrtSamplePerPixel;
-
     // Camera plane normal
     const glm::vec3 viewPlaneNormal = -glm::normalize(glm::cross(c1 - c2, c1 - c4));
 
-    // Shoot multiple rays through every pixel
-    for (int y = 0; y < static_cast<int>(width); y++)
-    {
-        std::vector<glm::vec3>& column = pixels[y];
-        logProgress();
+    // Calls sample(ray, rayFactor, random) for every camera ray through pixel
+    // (y, z). Each one gets a generator seeded by the pixel and the sample,
+    // drawing from the sampler, if any. The first two dimensions place the ray
+    // in the pixel, the sampler spreads them evenly for any sample count.
+    auto samplePixel = [&](int y, int z, const std::function<void(const Ray&, float, Random&)>& sample) {
+            for (unsigned int s = 0; s < samplePerPixel; s++)
+            {
+                Random random(s, (uint64_t)y * height + z);
+                random.setSampler(sampler.get(), s, y, z);
+
+                const float ylerp = (y + random.nextFloat()) * invWidth;
+                const float zlerp = (z + random.nextFloat()) * invHeight;
+                const float nx    = Math::bilinearInterpolation(ylerp, zlerp, c1.x, c2.x, c3.x, c4.x);
+                const float ny    = Math::bilinearInterpolation(ylerp, zlerp, c1.y, c2.y, c3.y, c4.y);
+                const float nz    = Math::bilinearInterpolation(ylerp, zlerp, c1.z, c2.z, c3.z, c4.z);
+
+                // Create ray
+                const glm::vec3 origin = glm::vec3(nx, ny, nz);
+                const Ray       ray(origin, glm::normalize(origin - eye));
+                const float     rayFactor =
+                    std::max(0.0f, glm::dot(-ray.direction, viewPlaneNormal));
+
+                sample(ray, rayFactor, random);
+            }
+        };
 
-#pragma omp parallel for
+    if (wavefront)
+    {
+        // Columns of camera rays traced as one wavefront
+        const int columns = std::max(1, (int)(WAVEFRONT_RAYS / (height * samplePerPixel)));
 
-        for (int z = 0; z < static_cast<int>(height); z++)
+        for (int y0 = 0; y0 < static_cast<int>(width); y0 += columns)
         {
-            // Shoot a bunch of rays through the pixel (y, z), and accumulate colors
-            Ray ray;
-            glm::vec3 colorAccumulator(0);
+            const int              y1 = std::min(static_cast<int>(width), y0 + columns);
+            std::vector<PathRay>   rays;
+            std::vector<glm::vec3> radiance((y1 - y0) * height, glm::vec3(0));
 
-            for (float c = 0; c < invWidth - columnStep + std::numeric_limits<float>::min();
-                 c += columnStep)
+            for (int y = y0; y < y1; y++)
             {
-                for (float r = 0; r < invHeight - rowStep + std::numeric_limits<float>::min();
-                     r += rowStep)
+                logProgress();
+
+                for (int z = 0; z < static_cast<int>(height); z++)
                 {
-                    // Calculate camera plane ray position using stratified sampling
-                    const float ylerp = y * invWidth + c + rand(gen) * columnStep;
-                    const float zlerp = z * invHeight + r + rand(gen) * rowStep;
-                    const float nx    = Math::bilinearInterpolation(ylerp, zlerp, c1.x, c2.x, c3.x, c4.x);
-                    const float ny    = Math::bilinearInterpolation(ylerp, zlerp, c1.y, c2.y, c3.y, c4.y);
-                    const float nz    = Math::bilinearInterpolation(ylerp, zlerp, c1.z, c2.z, c3.z, c4.z);
-
-                    // Create ray
-                    ray.origin    = glm::vec3(nx, ny, nz);
-                    ray.direction = glm::normalize(ray.origin - eye);
-                    const float rayFactor =
-                        std::max(0.0f, glm::dot(-ray.direction, viewPlaneNormal));
-
-                    // Shoot ray
-                    colorAccumulator += rayFactor * renderer.getPixelColor(ray);
+                    const unsigned int pixel = (y - y0) * height + z;
+
+                    samplePixel(y, z, [&](const Ray& ray, float rayFactor, Random& random) {
+                            rays.push_back(PathRay{ ray, glm::vec3(rayFactor), pixel, 0, random });
+                        });
                 }
             }
 
-            // Set pixel color dependent on the traced ray
-            column[z] = invSample * colorAccumulator;
+            renderer.traceWavefront(rays, radiance.data());
 
+            for (int y = y0; y < y1; y++)
+            {
+                for (int z = 0; z < static_cast<int>(height); z++)
+                {
+                    pixels[y][z] = invSample * radiance[(y - y0) * height + z];
+                }
+            }
+        }
+    }
+    else
+    {
+        // Shoot multiple rays through every pixel
+        for (int y = 0; y < static_cast<int>(width); y++)
+        {
+            std::vector<glm::vec3>& column = pixels[y];
+            logProgress();
+
+#pragma omp parallel for
+
+            for (int z = 0; z < static_cast<int>(height); z++)
+            {
+                // Shoot a bunch of rays through the pixel (y, z), and accumulate colors
+                glm::vec3 colorAccumulator(0);
+                RayPacket packet;
+                float     rayFactors[RayPacket::MAX_SIZE];
+                Random    randoms[RayPacket::MAX_SIZE];
+                glm::vec3 colors[RayPacket::MAX_SIZE];
+
+                auto tracePacket = [&]() {
+                        renderer.getPixelColors(packet, randoms, colors);
+
+                        for (unsigned i = 0; i < packet.size(); i++)
+                        {
+                            colorAccumulator += rayFactors[i] * colors[i];
+                        }
+
+                        packet.clear();
+                    };
+
+                samplePixel(y, z, [&](const Ray& ray, float rayFactor, Random& random) {
+                        // Shoot ray, or queue it until the packet is full
+                        if (packetSize == 0)
+                        {
+                            colorAccumulator += rayFactor * renderer.getPixelColor(ray, random);
+
+                            return;
+                        }
+
+                        rayFactors[packet.size()] = rayFactor;
+                        randoms[packet.size()]    = random;
+                        packet.add(ray);
+
+                        if (packet.size() == packetSize * packetSize) tracePacket();
+                    });
+
+                if (packet.size() > 0) tracePacket();
+
+                // Set pixel color dependent on the traced ray
+                column[z] = invSample * colorAccumulator;
+                RayStats::flush();
+
+            }
         }
     }
 
@@ -116,6 +184,7 @@ HumanTime Camera::render(const Scene& scene,
     const auto took = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count();
     auto time = toHumanTime(took / 1000);
     printf("\nRendering finished. Total time:  %02lld: %02lld: %02lld.\n", time.h, time.m, time.s);
+    RayStats::print(std::cout);
 
     // Create the final discretized image. Should always be done immediately after the rendering step
     createImage();
@@ -0,0 +1,54 @@
+#include "HaltonSampler.h"
+
+#include <algorithm>
+
+HaltonSampler::HaltonSampler(uint32_t seed)
+    : seed(seed)
+{
+    for (uint32_t candidate = 2; primes.size() < MAX_DIMENSIONS; candidate++)
+    {
+        bool prime = true;
+
+        for (uint32_t p : primes)
+        {
+            if (candidate % p == 0)
+            {
+                prime = false;
+                break;
+            }
+        }
+
+        if (prime) primes.push_back(candidate);
+    }
+}
+
+uint32_t HaltonSampler::sample(uint32_t index, uint32_t dimension, uint32_t x, uint32_t y) const
+{
+    const uint32_t base          = primes[dimension];
+    const double   invBase       = 1.0 / base;
+    const uint32_t dimensionSeed = hash(dimension, hash(hash(x, seed), y));
+    double         inverse       = 0.0;
+    double         factor        = invBase;
+    uint64_t       prefix        = 0; // Digits so far, as a number
+    uint64_t       place         = 1;
+
+    // Zero digits are scrambled too, so this goes on to the full precision
+    for (uint32_t digit = 0, n = index; factor * 4294967296.0 >= 1.0; digit++, n /= base)
+    {
+        const uint32_t h     = hash((uint32_t)prefix, hash(digit, dimensionSeed));
+        const uint32_t scale = 1 + h % (base - 1);
+        const uint32_t shift = (h >> 16) % base;
+        const uint32_t value = n % base;
+
+        inverse += ((scale * value + shift) % base) * factor;
+        factor  *= invBase;
+
+        if (place <= index)
+        {
+            prefix += value * place;
+            place  *= base;
+        }
+    }
+
+    return (uint32_t)std::min(inverse * 4294967296.0, 4294967295.0);
+}
@@ -1,131 +1,857 @@
 #include <vector>
+#include <cfloat>
+#include <algorithm>
+#include <atomic>
+#include <unordered_map>
 
 #include "KDTree.h"
+#include "Morton.h"
+#include "RayStats.h"
 
-// Build KD tree for tris
-KDNode * KDNode::build(std::vector<Triangle *>& tris, int depth)
+static const int SAH_BINS = 16;
+
+// Leaves are only forced above this size, below it the SAH decides
+static const size_t MAX_LEAF_SIZE = 8;
+
+struct SAHBin
+{
+    AABB box   = AABB::empty();
+    long count = 0;
+};
+
+// Subtrees with fewer references are built by the task that reached them
+static const size_t PARALLEL_BUILD_SIZE = 4096;
+
+// Spatial splits are tried where the children of the best object split
+// overlap by more than this fraction of the root surface
+static const float SPATIAL_SPLIT_OVERLAP = 1e-5f;
+
+// Meshes with more triangles get 63 bit Morton codes instead of 30 bit ones
+static const size_t LARGE_MESH_SIZE = 1 << 20;
+
+static AABB boundRefs(const PrimitiveRef* refs, size_t count)
+{
+    AABB box = AABB::empty();
+
+    for (size_t i = 0; i < count; i++)
+    {
+        box.expand(refs[i].box);
+    }
+
+    return box;
+}
+
+// Spatial split state shared by every task building one tree
+struct SpatialSplits
+{
+    std::atomic<long> budget;     // References that may still be added
+    float             minOverlap; // Object splits whose children overlap less are taken as they are
+};
+
+KDNode * KDNode::buildTree(const std::vector<Triangle *>& tris, const BuildOptions& options, Arena& arena)
 {
-    KDNode* node = new KDNode();
+    if (options.method == BuildMethod::Morton) return buildLinear(tris, arena);
 
-    if (tris.size() == 0) return node;
+    std::vector<PrimitiveRef> refs(tris.size());
+    AABB box = AABB::empty();
 
-    if ((depth > 25) || (tris.size() <= 6))
+    for (size_t i = 0; i < tris.size(); i++)
     {
-        node->triangles = tris;
-        node->leaf      = true;
-        node->box       = tris[0]->getBoundingBox();
+        refs[i].box      = tris[i]->getBoundingBox();
+        refs[i].center   = tris[i]->getCenter();
+        refs[i].triangle = tris[i];
+        box.expand(refs[i].box);
+    }
+
+    if (options.splitGrowth <= 0.0f)
+    {
+        return build(refs.data(), refs.size(), 0, nullptr, &arena);
+    }
 
-        for (long i = 1; i < tris.size(); i++)
+    SpatialSplits spatial;
+    spatial.budget     = (long)(options.splitGrowth * tris.size());
+    spatial.minOverlap = SPATIAL_SPLIT_OVERLAP * box.getHalfArea();
+
+    return build(refs.data(), refs.size(), 0, &spatial, &arena);
+}
+
+// Splits ref at position on axis into the parts of its triangle on either
+// side, each bounded by the box of ref. A part may come out empty.
+static void splitReference(const PrimitiveRef& ref, int axis, float position,
+                           PrimitiveRef& left, PrimitiveRef& right)
+{
+    AABB leftBox  = AABB::empty();
+    AABB rightBox = AABB::empty();
+
+    for (int i = 0; i < 3; i++)
+    {
+        const glm::vec3& v0 = ref.triangle->vertices[i];
+        const glm::vec3& v1 = ref.triangle->vertices[(i + 1) % 3];
+        const float      a  = v0[axis];
+        const float      b  = v1[axis];
+
+        if (a <= position) leftBox.expand(v0);
+
+        if (a >= position) rightBox.expand(v0);
+
+        // The edge crosses the plane, the crossing belongs to both sides
+        if (((a < position) && (b > position)) || ((a > position) && (b < position)))
         {
-            node->box.expand(tris[i]->getBoundingBox());
+            glm::vec3 p = v0 + (v1 - v0) * ((position - a) / (b - a));
+            p[axis] = position;
+            leftBox.expand(p);
+            rightBox.expand(p);
         }
+    }
 
-        node->left  = new KDNode();
-        node->right = new KDNode();
+    glm::vec3 leftMax  = ref.box.getMax();
+    glm::vec3 rightMin = ref.box.getMin();
+    leftMax[axis]  = std::min(leftMax[axis], position);
+    rightMin[axis] = std::max(rightMin[axis], position);
+
+    left.box       = leftBox.overlap(AABB(ref.box.getMin(), leftMax));
+    left.center    = left.box.getCenter();
+    left.triangle  = ref.triangle;
+    right.box      = rightBox.overlap(AABB(rightMin, ref.box.getMax()));
+    right.center   = right.box.getCenter();
+    right.triangle = ref.triangle;
+}
+
+// Finds the cheapest spatial split of refs adding at most budget references.
+// Bins cover the node box, and each reference is chopped into the bins it
+// spans so that every bin is bounded by the parts of triangles inside it.
+static float findSpatialSplit(const PrimitiveRef* refs, size_t count, const AABB& box, float invArea,
+                              long budget, int& bestAxis, float& bestPosition, long& duplicates)
+{
+    const glm::vec3 extent   = box.getMax() - box.getMin();
+    float           bestCost = INFINITY;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (extent[axis] <= 0.0f) continue;
+
+        AABB bins[SAH_BINS];
+        long entries[SAH_BINS] = {};
+        long exits[SAH_BINS]   = {};
+        const float lower    = box.getMin()[axis];
+        const float binWidth = extent[axis] / SAH_BINS;
+        const float scale    = SAH_BINS * (1.0f - FLT_EPSILON) / extent[axis];
+
+        for (int b = 0; b < SAH_BINS; b++)
+        {
+            bins[b] = AABB::empty();
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            const int first = std::min(SAH_BINS - 1, std::max(0, (int)((refs[i].box.getMin()[axis] - lower) * scale)));
+            const int last  = std::min(SAH_BINS - 1, std::max(first, (int)((refs[i].box.getMax()[axis] - lower) * scale)));
+            PrimitiveRef rest = refs[i];
+
+            for (int b = first; b < last; b++)
+            {
+                PrimitiveRef part;
+
+                splitReference(rest, axis, lower + binWidth * (b + 1), part, rest);
+                bins[b].expand(part.box);
+            }
+
+            bins[last].expand(rest.box);
+            entries[first]++;
+            exits[last]++;
+        }
+
+        float rightArea[SAH_BINS];
+        long  rightCount[SAH_BINS];
+        AABB  sweepBox   = AABB::empty();
+        long  sweepCount = 0;
+
+        for (int b = SAH_BINS - 1; b > 0; b--)
+        {
+            sweepBox.expand(bins[b]);
+            sweepCount   += exits[b];
+            rightArea[b]  = sweepBox.getHalfArea();
+            rightCount[b] = sweepCount;
+        }
+
+        sweepBox   = AABB::empty();
+        sweepCount = 0;
+
+        for (int b = 0; b < SAH_BINS - 1; b++)
+        {
+            sweepBox.expand(bins[b]);
+            sweepCount += entries[b];
+
+            const long added = sweepCount + rightCount[b + 1] - (long)count;
+
+            if ((sweepCount == 0) || (rightCount[b + 1] == 0) || (added > budget)) continue;
+
+            const float cost = SAH_TRAVERSAL_COST + SAH_INTERSECTION_COST * invArea *
+                               (sweepBox.getHalfArea() * sweepCount +
+                                rightArea[b + 1] * rightCount[b + 1]);
+
+            if (cost < bestCost)
+            {
+                bestCost     = cost;
+                bestAxis     = axis;
+                bestPosition = lower + binWidth * (b + 1);
+                duplicates   = added;
+            }
+        }
+    }
+
+    return bestCost;
+}
+
+// Builds both children of node. The two reference ranges are disjoint, so the
+// children can be built at the same time.
+static void buildChildren(KDNode* node, PrimitiveRef* left, size_t leftCount, PrimitiveRef* right,
+                          size_t rightCount, int depth, SpatialSplits* spatial, Arena* arena)
+{
+#if _OPENMP >= 200805
+    #pragma omp task if (leftCount + rightCount >= PARALLEL_BUILD_SIZE)
+#endif
+    node->left  = KDNode::build(left, leftCount, depth + 1, spatial, arena);
+    node->right = KDNode::build(right, rightCount, depth + 1, spatial, arena);
+#if _OPENMP >= 200805
+    #pragma omp taskwait
+#endif
+}
+
+// Build KD tree for refs
+KDNode * KDNode::build(PrimitiveRef* refs, size_t count, int depth, SpatialSplits* spatial, Arena* arena)
+{
+    KDNode* node = arena->create<KDNode>();
+
+    node->leaf = true;
+
+    if (count == 0) return node;
+
+    node->box = boundRefs(refs, count);
+
+    if ((depth >= KDTree::MAX_DEPTH) || (count <= 2))
+    {
+        node->makeLeaf(refs, count, *arena);
 
         return node;
     }
 
-    node->box = tris[0]->getBoundingBox();
-    glm::vec3 midpt     = glm::vec3();
-    float     tris_recp = 1.0f / tris.size();
+    // Bin the triangle centroids, the centroid bounds are the binning range
+    AABB centerBox = AABB::empty();
 
-    for (long i = 1; i < tris.size(); i++)
+    for (size_t i = 0; i < count; i++)
     {
-        node->box.expand(tris[i]->getBoundingBox());
-        midpt = midpt + (tris[i]->getCenter() * tris_recp);
+        centerBox.expand(refs[i].center);
     }
 
-    std::vector<Triangle *> left_tris;
-    std::vector<Triangle *> right_tris;
-    int axis = node->box.get_longest_axis();
+    const glm::vec3 extent       = centerBox.getMax() - centerBox.getMin();
+    const float     leafCost     = SAH_INTERSECTION_COST * count;
+    const float     invArea      = 1.0f / node->box.getHalfArea();
+    float           bestCost     = INFINITY;
+    int             bestAxis     = -1;
+    int             bestSplit    = 0;
+    AABB            bestLeftBox  = AABB::empty();
+    AABB            bestRightBox = AABB::empty();
 
-    for (auto tri : tris)
+    for (int axis = 0; axis < 3; axis++)
     {
-        switch (axis)
+        if (extent[axis] <= 0.0f) continue;
+
+        SAHBin bins[SAH_BINS];
+        const float scale = SAH_BINS * (1.0f - FLT_EPSILON) / extent[axis];
+
+        for (size_t i = 0; i < count; i++)
         {
-        case 0:
-            midpt.x >= tri->getCenter().x
-            ? right_tris.push_back(tri)
-            : left_tris.push_back(tri);
-            break;
+            int b = (int)((refs[i].center[axis] - centerBox.getMin()[axis]) * scale);
 
-        case 1:
-            midpt.y >= tri->getCenter().y
-            ? right_tris.push_back(tri)
-            : left_tris.push_back(tri);
-            break;
+            bins[b].box.expand(refs[i].box);
+            bins[b].count++;
+        }
+
+        // Sweep from the right to get the cost of every right side, then
+        // from the left to evaluate each split plane between bins
+        AABB  rightBox[SAH_BINS];
+        long  rightCount[SAH_BINS];
+        AABB  sweepBox   = AABB::empty();
+        long  sweepCount = 0;
+
+        for (int b = SAH_BINS - 1; b > 0; b--)
+        {
+            sweepBox.expand(bins[b].box);
+            sweepCount   += bins[b].count;
+            rightBox[b]   = sweepBox;
+            rightCount[b] = sweepCount;
+        }
+
+        sweepBox   = AABB::empty();
+        sweepCount = 0;
+
+        for (int b = 0; b < SAH_BINS - 1; b++)
+        {
+            sweepBox.expand(bins[b].box);
+            sweepCount += bins[b].count;
+
+            if ((sweepCount == 0) || (rightCount[b + 1] == 0)) continue;
+
+            const float cost = SAH_TRAVERSAL_COST + SAH_INTERSECTION_COST * invArea *
+                               (sweepBox.getHalfArea() * sweepCount +
+                                rightBox[b + 1].getHalfArea() * rightCount[b + 1]);
 
-        case 2:
-            midpt.z >= tri->getCenter().z
-            ? right_tris.push_back(tri)
-            : left_tris.push_back(tri);
-            break;
+            if (cost < bestCost)
+            {
+                bestCost     = cost;
+                bestAxis     = axis;
+                bestSplit    = b;
+                bestLeftBox  = sweepBox;
+                bestRightBox = rightBox[b + 1];
+            }
         }
     }
 
-    if ((tris.size() == left_tris.size()) || (tris.size() == right_tris.size()))
+    // Spatial splits only pay off where the object split leaves the children
+    // overlapping, typically around long thin triangles
+    float spatialCost     = INFINITY;
+    int   spatialAxis     = 0;
+    float spatialPosition = 0.0f;
+    long  duplicates      = 0;
+
+    if (spatial)
     {
-        node->triangles = tris;
-        node->leaf      = true;
-        node->box       = tris[0]->getBoundingBox();
+        const AABB overlap = bestLeftBox.overlap(bestRightBox);
 
-        for (long i = 1; i < tris.size(); i++)
+        if ((bestAxis < 0) || (!overlap.isEmpty() && (overlap.getHalfArea() > spatial->minOverlap)))
         {
-            node->box.expand(tris[i]->getBoundingBox());
+            spatialCost = findSpatialSplit(refs, count, node->box, invArea, spatial->budget.load(),
+                                           spatialAxis, spatialPosition, duplicates);
         }
+    }
 
-        node->left             = new KDNode();
-        node->right            = new KDNode();
-        node->left->triangles  = std::vector<Triangle *>();
-        node->right->triangles = std::vector<Triangle *>();
+    // Without an object split all centroids coincide, which only a count split
+    // or a spatial split can separate
+    if ((std::min(bestCost, spatialCost) >= leafCost) && (count <= MAX_LEAF_SIZE))
+    {
+        node->makeLeaf(refs, count, *arena);
 
         return node;
     }
 
-    node->left  = build(left_tris, depth + 1);
-    node->right = build(right_tris, depth + 1);
+    bool spatialSplit = spatialCost < bestCost;
+
+    // Take the budget first, other tasks may be spending it at the same time
+    if (spatialSplit && (spatial->budget.fetch_sub(duplicates) < duplicates))
+    {
+        spatial->budget += duplicates;
+        spatialSplit     = false;
+    }
+
+    if (spatialSplit)
+    {
+        std::vector<PrimitiveRef> leftRefs, rightRefs;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            const PrimitiveRef& ref = refs[i];
+
+            if (ref.box.getMax()[spatialAxis] <= spatialPosition)
+            {
+                leftRefs.push_back(ref);
+            }
+            else if (ref.box.getMin()[spatialAxis] >= spatialPosition)
+            {
+                rightRefs.push_back(ref);
+            }
+            else
+            {
+                PrimitiveRef left, right;
+
+                splitReference(ref, spatialAxis, spatialPosition, left, right);
+
+                if (!left.box.isEmpty()) leftRefs.push_back(left);
+
+                if (!right.box.isEmpty()) rightRefs.push_back(right);
+            }
+        }
+
+        // Give back what the binned estimate reserved too much
+        const long added = (long)leftRefs.size() + (long)rightRefs.size() - (long)count;
+
+        spatial->budget += duplicates - added;
+
+        if (!leftRefs.empty() && !rightRefs.empty())
+        {
+            node->leaf = false;
+            node->axis = spatialAxis;
+            buildChildren(node, leftRefs.data(), leftRefs.size(), rightRefs.data(), rightRefs.size(),
+                          depth, spatial, arena);
+
+            return node;
+        }
+
+        spatial->budget += added;
+    }
+
+    // Without the spatial split the object split has to beat a leaf on its own
+    if ((bestCost >= leafCost) && (count <= MAX_LEAF_SIZE))
+    {
+        node->makeLeaf(refs, count, *arena);
+
+        return node;
+    }
+
+    size_t mid;
+
+    if (bestAxis >= 0)
+    {
+        const float scale = SAH_BINS * (1.0f - FLT_EPSILON) / extent[bestAxis];
+        const float lower = centerBox.getMin()[bestAxis];
+
+        mid = std::partition(refs, refs + count, [&](const PrimitiveRef& ref) {
+                return (int)((ref.center[bestAxis] - lower) * scale) <= bestSplit;
+            }) - refs;
+    }
+    else
+    {
+        // Split by count instead of giving up on the whole set
+        bestAxis = node->box.get_longest_axis();
+        mid      = count / 2;
+    }
+
+    node->leaf = false;
+    node->axis = bestAxis;
+    buildChildren(node, refs, mid, refs + mid, count - mid, depth, spatial, arena);
 
     return node;
 }
 
-// Finds nearest triangle in kd tree that intersects with ray.
-bool KDNode::hit(KDNode* node, const Ray& ray, float& t, float& tmin, long& tri_idx)
+void KDNode::makeLeaf(const PrimitiveRef* refs, size_t count, Arena& arena)
 {
-    float dist;
+    triangles     = arena.allocateArray<Triangle *>(count);
+    triangleCount = count;
 
-    if (node->box.intersection(ray, dist))
+    for (size_t i = 0; i < count; i++)
     {
-        if (dist > tmin) return false;
+        triangles[i] = refs[i].triangle;
+    }
+}
 
-        bool hit_tri   = false;
-        bool hit_left  = false;
-        bool hit_right = false;
+// Turns the subtree of the radix tree at index into nodes. Returns the SAH cost
+// of the subtree in cost, relative to an area of 1.
+static KDNode* convertRadixTree(const Morton::Node* nodes, const PrimitiveRef* refs,
+                                unsigned index, bool isLeaf, float& cost, Arena* arena)
+{
+    KDNode* node = arena->create<KDNode>();
 
-        if (!node->leaf)
-        {
-            hit_left  = hit(node->left, ray, t, tmin, tri_idx);
-            hit_right = hit(node->right, ray, t, tmin, tri_idx);
+    if (isLeaf)
+    {
+        node->leaf = true;
+        node->box  = refs[index].box;
+        node->makeLeaf(refs + index, 1, *arena);
+        cost = SAH_INTERSECTION_COST * node->box.getHalfArea();
+
+        return node;
+    }
+
+    const Morton::Node& split = nodes[index];
+    const size_t        count = split.last - split.first + 1;
+    float leftCost, rightCost;
+
+#if _OPENMP >= 200805
+    #pragma omp task if (count >= PARALLEL_BUILD_SIZE) shared(leftCost)
+#endif
+    node->left  = convertRadixTree(nodes, refs, split.child[0], split.leaf[0], leftCost, arena);
+    node->right = convertRadixTree(nodes, refs, split.child[1], split.leaf[1], rightCost, arena);
+#if _OPENMP >= 200805
+    #pragma omp taskwait
+#endif
+
+    node->box = node->left->box;
+    node->box.expand(node->right->box);
+
+    const float area     = node->box.getHalfArea();
+    const float leafCost = SAH_INTERSECTION_COST * area * count;
+
+    cost = SAH_TRAVERSAL_COST * area + leftCost + rightCost;
+
+    // The radix tree ends in single triangles, merge them back into leaves
+    // wherever that is cheaper. The children stay in the arena until the end
+    // of the build.
+    if ((count <= MAX_LEAF_SIZE) && (leafCost <= cost))
+    {
+        node->left  = nullptr;
+        node->right = nullptr;
+        node->leaf  = true;
+        node->makeLeaf(refs + split.first, count, *arena);
+        cost = leafCost;
+
+        return node;
+    }
+
+    // The children are ordered along the axis that separates them most
+    const glm::vec3 separation = glm::abs(node->right->box.getCenter() - node->left->box.getCenter());
+
+    node->leaf = false;
+    node->axis = separation.x > separation.y
+                 ? (separation.x > separation.z ? 0 : 2)
+                 : (separation.y > separation.z ? 1 : 2);
+
+    return node;
+}
 
-            return hit_left || hit_right;
+KDNode * KDNode::buildLinear(const std::vector<Triangle *>& tris, Arena& arena)
+{
+    const size_t count = tris.size();
+
+    if (count == 0)
+    {
+        KDNode* node = arena.create<KDNode>();
+        node->leaf = true;
+
+        return node;
+    }
+
+    std::vector<glm::vec3> centers(count);
+    AABB centerBox = AABB::empty();
+
+    for (size_t i = 0; i < count; i++)
+    {
+        centers[i] = tris[i]->getCenter();
+        centerBox.expand(centers[i]);
+    }
+
+    // 30 bit codes sort in half the passes, large meshes need the resolution
+    // of 63 bits to keep neighbouring triangles apart
+    const int bitsPerAxis = count > LARGE_MESH_SIZE ? 21 : 10;
+    std::vector<Morton::Item> items;
+
+    Morton::encode(centers, centerBox, bitsPerAxis, items);
+    Morton::sort(items, 3 * bitsPerAxis);
+
+    std::vector<PrimitiveRef> refs(count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const Triangle* tri = tris[items[i].index];
+
+        refs[i].box      = tri->getBoundingBox();
+        refs[i].center   = centers[items[i].index];
+        refs[i].triangle = tris[items[i].index];
+    }
+
+    std::vector<Morton::Node> nodes;
+    float cost;
+
+    Morton::buildHierarchy(items, nodes);
+
+    return convertRadixTree(nodes.data(), refs.data(), 0, count == 1, cost, &arena);
+}
+
+KDTree::KDTree(ArrayView<KDTreeNode> mappedNodes, ArrayView<TrianglePacket> mappedPackets)
+    : nodes(mappedNodes), packets(mappedPackets)
+{}
+
+KDTree::KDTree(const std::vector<Triangle *>& tris, const BuildOptions& options)
+{
+    Arena   arena;
+    KDNode* root = KDNode::buildTree(tris, options, arena);
+
+    flatten(root, options.layout);
+}
+
+static int pairHeight(const KDNode* node, std::unordered_map<const KDNode *, int>& heights)
+{
+    if (node->leaf) return 0;
+
+    const int height = 1 + std::max(pairHeight(node->left, heights), pairHeight(node->right, heights));
+
+    heights[node] = height;
+
+    return height;
+}
+
+static void collectAtDepth(const KDNode* node, int depth, std::vector<const KDNode *>& out)
+{
+    if (node->leaf) return;
+
+    if (depth == 0)
+    {
+        out.push_back(node);
+
+        return;
+    }
+
+    collectAtDepth(node->left, depth - 1, out);
+    collectAtDepth(node->right, depth - 1, out);
+}
+
+// Emits the child pairs of the subtree below node, truncated to height
+// levels, in van Emde Boas order: the top half of the levels first, then each
+// subtree hanging off it
+static void layoutVanEmdeBoas(const KDNode* node, int height, std::vector<const KDNode *>& order,
+                              const std::unordered_map<const KDNode *, int>& heights)
+{
+    if (height == 1)
+    {
+        order.push_back(node);
+
+        return;
+    }
+
+    const int top = height / 2;
+    std::vector<const KDNode *> bottom;
+
+    layoutVanEmdeBoas(node, top, order, heights);
+    collectAtDepth(node, top, bottom);
+
+    for (auto subtree : bottom)
+    {
+        layoutVanEmdeBoas(subtree, std::min(height - top, heights.at(subtree)), order, heights);
+    }
+}
+
+static void layoutDepthFirst(const KDNode* node, std::vector<const KDNode *>& order)
+{
+    if (node->leaf) return;
+
+    order.push_back(node);
+    layoutDepthFirst(node->left, order);
+    layoutDepthFirst(node->right, order);
+}
+
+// The root goes to slot 0, slot 1 is padding so that every child pair starts
+// on an even slot and therefore on a cache line of its own. The layouts only
+// decide the order of the pairs, identified by their parent.
+void KDTree::flatten(const KDNode* root, TreeLayout layout)
+{
+    nodeStorage.clear();
+
+    if ((root->triangleCount == 0) && root->leaf) return;
+
+    std::vector<const KDNode *> order;
+
+    if (layout == TreeLayout::VanEmdeBoas)
+    {
+        std::unordered_map<const KDNode *, int> heights;
+        const int height = pairHeight(root, heights);
+
+        if (height > 0) layoutVanEmdeBoas(root, height, order, heights);
+    }
+    else
+    {
+        layoutDepthFirst(root, order);
+    }
+
+    std::unordered_map<const KDNode *, unsigned> pairSlot;
+
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        pairSlot[order[i]] = (unsigned)(2 + 2 * i);
+    }
+
+    nodeStorage.resize(2 + 2 * order.size());
+
+    struct Item
+    {
+        const KDNode* node;
+        unsigned      slot;
+    };
+
+    std::vector<Item> stack(1, Item{ root, 0 });
+
+    while (!stack.empty())
+    {
+        const Item item = stack.back();
+        stack.pop_back();
+
+        KDTreeNode& flat = nodeStorage[item.slot];
+        flat.box = item.node->box;
+
+        if (item.node->leaf)
+        {
+            flat.offset = packets.add(item.node->triangles, item.node->triangleCount);
+            flat.count  = (unsigned)item.node->triangleCount;
+            flat.axis   = 0;
         }
         else
         {
-            auto triangles_size = node->triangles.size();
+            flat.offset = pairSlot[item.node];
+            flat.count  = 0;
+            flat.axis   = (unsigned)item.node->axis;
+
+            stack.push_back(Item{ item.node->right, flat.offset + 1 });
+            stack.push_back(Item{ item.node->left, flat.offset });
+        }
+    }
+
+    nodes = nodeStorage;
+}
+
+bool KDTree::hit(const Ray& ray, float& tmin, long& tri_idx) const
+{
+    return traverse<false>(ray, tmin, tri_idx);
+}
+
+bool KDTree::occluded(const Ray& ray, float tMax) const
+{
+    long tri_idx;
+
+    return traverse<true>(ray, tMax, tri_idx);
+}
+
+// Finds nearest triangle in kd tree that intersects with ray. Children are
+// visited near first, judged by the ray direction along the split axis, and
+// anything entered beyond the closest hit so far is skipped. An any hit query
+// returns at the first triangle closer than tmin instead.
+template<bool AnyHit>
+bool KDTree::traverse(const Ray& ray, float& tmin, long& tri_idx) const
+{
+    struct Entry
+    {
+        unsigned node;
+        float    t;
+    };
+
+    Entry    stack[MAX_DEPTH];
+    int      stackSize = 0;
+    unsigned current   = 0;
+    float    dist;
+    bool     hit_tri   = false;
+
+    if (nodes.empty() || !nodes[0].box.intersection(ray, tmin, dist)) return false;
+
+    while (true)
+    {
+        const KDTreeNode& node = nodes[current];
 
-            for (size_t i = 0; i < triangles_size; i++)
+        RayStats::countNode();
+
+        if (node.count == 0)
+        {
+            const unsigned near = node.offset + ray.sign[node.axis];
+            const unsigned far  = node.offset + 1 - ray.sign[node.axis];
+            float tNear, tFar;
+            const bool hitNear = nodes[near].box.intersection(ray, tmin, tNear);
+            const bool hitFar  = nodes[far].box.intersection(ray, tmin, tFar);
+
+            if (hitNear)
             {
-                if (node->triangles[i]->rayIntersection(ray, t) && (t < tmin))
-                {
-                    hit_tri = true;
-                    tmin    = t;
-                    tri_idx = node->triangles[i]->meshIndex;
-                }
+                if (hitFar) stack[stackSize++] = { far, tFar };
+
+                current = near;
+
+                continue;
             }
 
-            return hit_tri;
+            if (hitFar)
+            {
+                current = far;
+
+                continue;
+            }
         }
+        else
+        {
+            if (AnyHit)
+            {
+                if (packets.occluded(ray, node.offset, node.count, tmin)) return true;
+            }
+            else if (packets.intersect(ray, node.offset, node.count, tmin, tri_idx))
+            {
+                hit_tri = true;
+            }
+        }
+
+        // Pop the next subtree that still starts before the closest hit
+        do
+        {
+            if (stackSize == 0) return hit_tri;
+
+            --stackSize;
+        } while (stack[stackSize].t > tmin);
+
+        current = stack[stackSize].node;
+    }
+}
+
+// Same order as traverse, with the direction signs shared by the packet. Each
+// node is entered with the first ray still active in it, the rays before that
+// one miss it and are dropped for the whole subtree.
+uint64_t KDTree::hitPacket(const RayPacket& packet, unsigned first, float* tmin, long* tri_idx) const
+{
+    struct Entry
+    {
+        unsigned node;
+        unsigned first;
+    };
+
+    if (!packet.isCoherent()) return Accelerator::hitPacket(packet, first, tmin, tri_idx);
+
+    Entry    stack[MAX_DEPTH + 1];
+    int      stackSize = 0;
+    uint64_t hits      = 0;
+
+    if (nodes.empty()) return 0;
+
+    stack[stackSize++] = { 0, first };
+
+    while (stackSize > 0)
+    {
+        const Entry       entry  = stack[--stackSize];
+        const KDTreeNode& node   = nodes[entry.node];
+        const unsigned    active = packet.firstActive(node.box, entry.first, tmin);
+
+        if (active == packet.size()) continue;
+
+        RayStats::countNode();
+
+        if (node.count == 0)
+        {
+            const unsigned near = node.offset + packet.isNegative(node.axis);
+            const unsigned far  = node.offset + 1 - packet.isNegative(node.axis);
+
+            stack[stackSize++] = { far, active };
+            stack[stackSize++] = { near, active };
+
+            continue;
+        }
+
+        for (unsigned i = active; i < packet.size(); i++)
+        {
+            if (packets.intersect(packet[i], node.offset, node.count, tmin[i], tri_idx[i]))
+            {
+                hits |= (uint64_t)1 << i;
+            }
+        }
+    }
+
+    return hits;
+}
+
+TreeStats KDTree::getStats() const
+{
+    TreeStats stats;
+
+    if (nodes.empty()) return stats;
+
+    const float rootArea = nodes[0].box.getHalfArea();
+
+    collectStats(stats, 0, 0, rootArea > 0.0f ? 1.0f / rootArea : 0.0f);
+
+    return stats;
+}
+
+void KDTree::collectStats(TreeStats& stats, unsigned nodeIndex, int depth, float invRootArea) const
+{
+    const KDTreeNode& node = nodes[nodeIndex];
+    const float       area = node.box.getHalfArea() * invRootArea;
+
+    if (node.count > 0)
+    {
+        stats.addLeaf(node.count, area, depth);
+
+        return;
     }
 
-    return false;
+    stats.addInner(area, depth);
+    collectStats(stats, node.offset, depth + 1, invRootArea);
+    collectStats(stats, node.offset + 1, depth + 1, invRootArea);
 }
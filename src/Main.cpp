@@ -1,5 +1,7 @@
 #include <iostream>
 #include <string>
+#include <vector>
+#include <utility>
 
 #include <cxxopts.hpp>
 
@@ -78,9 +80,12 @@ static HumanTime renderScene(const Scene& scene,
                  SceneID      sceneID,
                  Camera     & camera,
                  int          maxRayDepth,
+                 int          rouletteDepth,
+                 bool         fresnelSampling,
                  int          samplePerPixel)
 {
-    Renderer renderer(scene, maxRayDepth);
+    Renderer renderer(scene, maxRayDepth, rouletteDepth);
+    renderer.setFresnelSampling(fresnelSampling);
     glm::vec3 eye;
     glm::vec3 direction;
     const glm::vec3 up = glm::vec3(0, 1, 0);
@@ -105,6 +110,36 @@ static HumanTime renderScene(const Scene& scene,
     return camera.render(scene, renderer, samplePerPixel, eye, direction, up);;
 }
 
+// Stores the value named by option value in choice. Prints the accepted names
+// and returns false if value is none of them.
+template<typename T>
+static bool parseChoice(const std::string                             & option,
+                        const std::string                             & value,
+                        const std::vector<std::pair<std::string, T> > & choices,
+                        T                                             & choice)
+{
+    for (const auto& named : choices)
+    {
+        if (named.first == value)
+        {
+            choice = named.second;
+
+            return true;
+        }
+    }
+
+    std::cout << "Error: unknown --" << option << " value: " << value << ", use";
+
+    for (size_t i = 0; i < choices.size(); i++)
+    {
+        std::cout << (i == 0 ? " " : i + 1 == choices.size() ? " or " : ", ") << choices[i].first;
+    }
+
+    std::cout << std::endl;
+
+    return false;
+}
+
 // Returns a string that represents the current date and time
 static std::string currentDateTime()
 {
@@ -133,8 +168,29 @@ int main(int argc, char** argv)
             cxxopts::value<unsigned int>()->default_value("4"))
         ("d,depth", "Maximum trace depth (default 4)",
             cxxopts::value<unsigned int>()->default_value("4"))
+        ("roulette", "Depth from which paths are ended at random by their throughput (default 3)",
+            cxxopts::value<unsigned int>()->default_value("3"))
         ("p,pixel", "Pixel resolution width & height (default 1024)",
-            cxxopts::value<unsigned int>()->default_value("1024"));
+            cxxopts::value<unsigned int>()->default_value("1024"))
+        ("layout", "Tree node layout: dfs or veb (default dfs)",
+            cxxopts::value<std::string>()->default_value("dfs"))
+        ("width", "Tree width: 2, or 4 / 8 for a wide BVH (default 2)",
+            cxxopts::value<unsigned int>()->default_value("2"))
+        ("tree", "Mesh hierarchy: bvh or kd (default bvh)",
+            cxxopts::value<std::string>()->default_value("bvh"))
+        ("build", "BVH build: sah, or morton for a fast preview build (default sah)",
+            cxxopts::value<std::string>()->default_value("sah"))
+        ("sbvh", "Spatial splits in the SAH build, adding at most this fraction of references (default 0, off)",
+            cxxopts::value<float>()->default_value("0"))
+        ("packet", "Primary ray packets of n x n samples, 4 or 8, 0 for single rays (default 0)",
+            cxxopts::value<unsigned int>()->default_value("0"))
+        ("wavefront", "Trace all paths one bounce at a time, with sorted ray batches")
+        ("sampler", "Sample points: random, sobol, halton or bluenoise (default sobol)",
+            cxxopts::value<std::string>()->default_value("sobol"))
+        ("fresnel", "Either refract or reflect at transparent surfaces, picked by the Fresnel weights")
+        ("cache", "Directory for scene caches, empty to load without one (default empty)",
+            cxxopts::value<std::string>()->default_value(""))
+        ("hugepages", "Keep the scene geometry in transparent huge pages where supported");
 
     auto result = options.parse(argc, argv);
 
@@ -142,10 +198,67 @@ int main(int argc, char** argv)
     const unsigned int height         = result["pixel"].as<unsigned int>();
     const unsigned int samplePerPixel = result["ray"].as<unsigned int>();
     const unsigned int maxRayDepth    = result["depth"].as<unsigned int>();
+    const unsigned int rouletteDepth  = result["roulette"].as<unsigned int>();
     const SceneID predefinedScene     = static_cast<SceneID>(result["scene"].as<unsigned int>());
 
+    BuildOptions buildOptions;
+
+    if (!parseChoice("layout", result["layout"].as<std::string>(),
+                     { { "dfs", TreeLayout::DepthFirst }, { "veb", TreeLayout::VanEmdeBoas } },
+                     buildOptions.layout))
+    {
+        return 1;
+    }
+
+    buildOptions.width = result["width"].as<unsigned int>();
+
+    if ((buildOptions.width != 2) && (buildOptions.width != 4) && (buildOptions.width != 8))
+    {
+        std::cout << "Error: unknown --width value: " << buildOptions.width << ", use 2, 4 or 8" << std::endl;
+
+        return 1;
+    }
+
+    if (!parseChoice("build", result["build"].as<std::string>(),
+                     { { "sah", BuildMethod::BinnedSAH }, { "morton", BuildMethod::Morton } },
+                     buildOptions.method))
+    {
+        return 1;
+    }
+
+    buildOptions.splitGrowth = result["sbvh"].as<float>();
+
+    if (!parseChoice("tree", result["tree"].as<std::string>(),
+                     { { "bvh", Partitioning::Object }, { "kd", Partitioning::Spatial } },
+                     buildOptions.partitioning))
+    {
+        return 1;
+    }
+
+    SamplerType samplerType = SamplerType::Sobol;
+
+    if (!parseChoice("sampler", result["sampler"].as<std::string>(),
+                     { { "random", SamplerType::Random }, { "sobol", SamplerType::Sobol },
+                       { "halton", SamplerType::Halton }, { "bluenoise", SamplerType::BlueNoise } },
+                     samplerType))
+    {
+        return 1;
+    }
+
+    const unsigned int packetSize = result["packet"].as<unsigned int>();
+
+    if ((packetSize != 0) && (packetSize != 4) && (packetSize != 8))
+    {
+        std::cout << "Error: unknown --packet value: " << packetSize << ", use 0, 4 or 8" << std::endl;
+
+        return 1;
+    }
+
     // Create scene
     Scene scene;
+    scene.setBuildOptions(buildOptions);
+    scene.setCacheDirectory(result["cache"].as<std::string>());
+    scene.setHugePages(result["hugepages"].as<bool>());
 
     try
     {
@@ -161,10 +274,16 @@ int main(int argc, char** argv)
     }
 
     scene.initialize();
+    std::cout << "Trees built in " << scene.getBuildTime() << " ms." << std::endl;
+    scene.getTreeStats().print(std::cout);
 
     // Render scene
     Camera camera(width, height);
-    auto time = renderScene(scene, predefinedScene, camera, maxRayDepth, samplePerPixel);
+    camera.setPacketSize(packetSize);
+    camera.setWavefront(result["wavefront"].as<bool>());
+    camera.setSampler(Sampler::create(samplerType));
+    auto time = renderScene(scene, predefinedScene, camera, maxRayDepth, rouletteDepth,
+                            result["fresnel"].as<bool>(), samplePerPixel);
 
     // Write out
     char fileNameBuffer[80];
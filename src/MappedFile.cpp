@@ -0,0 +1,77 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+# define WIN32_LEAN_AND_MEAN
+# define NOMINMAX
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string& path)
+{
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        file = nullptr;
+
+        return;
+    }
+
+    LARGE_INTEGER fileSize;
+
+    if (!GetFileSizeEx(file, &fileSize) || (fileSize.QuadPart == 0)) return;
+
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+    if (!mapping) return;
+
+    base   = static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    length = base ? (size_t)fileSize.QuadPart : 0;
+}
+
+MappedFile::~MappedFile()
+{
+    if (base) UnmapViewOfFile(base);
+
+    if (mapping) CloseHandle(mapping);
+
+    if (file) CloseHandle(file);
+}
+
+#else // ifdef _WIN32
+MappedFile::MappedFile(const std::string& path)
+{
+    const int fd = open(path.c_str(), O_RDONLY);
+
+    if (fd < 0) return;
+
+    struct stat info;
+
+    if ((fstat(fd, &info) == 0) && (info.st_size > 0))
+    {
+        void* p = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+        if (p != MAP_FAILED)
+        {
+            base   = static_cast<const char *>(p);
+            length = (size_t)info.st_size;
+        }
+    }
+
+    // The mapping stays valid without the descriptor
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (base) munmap(const_cast<char *>(base), length);
+}
+
+#endif // ifdef _WIN32
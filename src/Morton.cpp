@@ -0,0 +1,216 @@
+#include <algorithm>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "Morton.h"
+
+static const int RADIX_BITS = 8;
+static const int RADIX_SIZE = 1 << RADIX_BITS;
+
+// Items are split into this many blocks, each sorted into place by one task
+static const int SORT_BLOCKS = 64;
+
+// Items encoded or turned into nodes by one task
+static const int TASK_SIZE = 16384;
+
+// Calls body(b) for every block b in [0, blocks) and waits for all of them.
+// The blocks run as tasks of the enclosing team, so threads that are done
+// with their own mesh help out with this one.
+template<typename Body>
+static void forEachBlock(int blocks, const Body& body)
+{
+    for (int b = 0; b < blocks; b++)
+    {
+#if _OPENMP >= 200805
+        #pragma omp task
+#endif
+        body(b);
+    }
+#if _OPENMP >= 200805
+    #pragma omp taskwait
+#endif
+}
+
+static inline int blockBegin(int count, int blocks, int b)
+{
+    return (int)((long long)count * b / blocks);
+}
+
+// Spreads the lowest 21 bits of v out to every third bit
+static inline uint64_t expandBits(uint64_t v)
+{
+    v &= 0x1fffff;
+    v  = (v | v << 32) & 0x1f00000000ffffull;
+    v  = (v | v << 16) & 0x1f0000ff0000ffull;
+    v  = (v | v << 8) & 0x100f00f00f00f00full;
+    v  = (v | v << 4) & 0x10c30c30c30c30c3ull;
+    v  = (v | v << 2) & 0x1249249249249249ull;
+
+    return v;
+}
+
+static inline int countLeadingZeros(uint64_t v)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+
+    return _BitScanReverse64(&index, v) ? 63 - (int)index : 64;
+#else
+    return v ? __builtin_clzll(v) : 64;
+#endif
+}
+
+void Morton::encode(const std::vector<glm::vec3>& points, const AABB& bounds, int bitsPerAxis,
+                    std::vector<Item>& items)
+{
+    const float     cells  = (float)((1u << bitsPerAxis) - 1);
+    const glm::vec3 extent = bounds.getMax() - bounds.getMin();
+    const glm::vec3 scale  = glm::vec3(
+        extent.x > 0.0f ? cells / extent.x : 0.0f,
+        extent.y > 0.0f ? cells / extent.y : 0.0f,
+        extent.z > 0.0f ? cells / extent.z : 0.0f);
+
+    const int count  = (int)points.size();
+    const int blocks = (count + TASK_SIZE - 1) / TASK_SIZE;
+
+    items.resize(points.size());
+
+    forEachBlock(blocks, [&](int b) {
+            for (int i = blockBegin(count, blocks, b); i < blockBegin(count, blocks, b + 1); i++)
+            {
+                const glm::vec3 cell = glm::clamp((points[i] - bounds.getMin()) * scale,
+                                                  glm::vec3(0.0f), glm::vec3(cells));
+
+                items[i].code = expandBits((uint64_t)cell.x) << 2 |
+                                expandBits((uint64_t)cell.y) << 1 |
+                                expandBits((uint64_t)cell.z);
+                items[i].index = (unsigned)i;
+            }
+        });
+}
+
+// Every pass counts the digits of each block in parallel, turns the counts
+// into the first output slot of every (digit, block) pair and scatters the
+// blocks in parallel. Blocks keep their order, so each pass is stable.
+void Morton::sort(std::vector<Item>& items, int bits)
+{
+    const int         count  = (int)items.size();
+    const int         blocks = std::max(1, std::min(SORT_BLOCKS, count / RADIX_SIZE));
+    std::vector<Item> buffer(items.size());
+    std::vector<long> slots(blocks * RADIX_SIZE);
+
+    for (int shift = 0; shift < bits; shift += RADIX_BITS)
+    {
+        std::fill(slots.begin(), slots.end(), 0);
+
+        forEachBlock(blocks, [&](int b) {
+                for (int i = blockBegin(count, blocks, b); i < blockBegin(count, blocks, b + 1); i++)
+                {
+                    slots[b * RADIX_SIZE + ((items[i].code >> shift) & (RADIX_SIZE - 1))]++;
+                }
+            });
+
+        long offset = 0;
+
+        for (int digit = 0; digit < RADIX_SIZE; digit++)
+        {
+            for (int b = 0; b < blocks; b++)
+            {
+                const long size = slots[b * RADIX_SIZE + digit];
+
+                slots[b * RADIX_SIZE + digit] = offset;
+                offset                       += size;
+            }
+        }
+
+        forEachBlock(blocks, [&](int b) {
+                for (int i = blockBegin(count, blocks, b); i < blockBegin(count, blocks, b + 1); i++)
+                {
+                    buffer[slots[b * RADIX_SIZE + ((items[i].code >> shift) & (RADIX_SIZE - 1))]++] = items[i];
+                }
+            });
+
+        items.swap(buffer);
+    }
+}
+
+// Length of the common prefix of the codes at i and j, -1 if j is out of range
+static inline int commonPrefix(const std::vector<Morton::Item>& items, int i, int j)
+{
+    if ((j < 0) || (j >= (int)items.size())) return -1;
+
+    const uint64_t a = items[i].code;
+    const uint64_t b = items[j].code;
+
+    if (a == b) return 64 + countLeadingZeros((uint64_t)(i ^ j));
+
+    return countLeadingZeros(a ^ b);
+}
+
+// Inner node i of the radix tree
+static void buildNode(const std::vector<Morton::Item>& items, Morton::Node& node, int i)
+{
+    const int direction = commonPrefix(items, i, i + 1) > commonPrefix(items, i, i - 1) ? 1 : -1;
+    const int minPrefix = commonPrefix(items, i, i - direction);
+
+    // Find the other end of the range by exponential then binary search
+    int maxLength = 2;
+
+    while (commonPrefix(items, i, i + maxLength * direction) > minPrefix)
+    {
+        maxLength *= 2;
+    }
+
+    int length = 0;
+
+    for (int step = maxLength / 2; step >= 1; step /= 2)
+    {
+        if (commonPrefix(items, i, i + (length + step) * direction) > minPrefix)
+        {
+            length += step;
+        }
+    }
+
+    const int j          = i + length * direction;
+    const int nodePrefix = commonPrefix(items, i, j);
+
+    // The split is where the prefix of the whole range ends
+    int split = 0;
+    int step  = length;
+
+    do
+    {
+        step = (step + 1) / 2;
+
+        if (commonPrefix(items, i, i + (split + step) * direction) > nodePrefix)
+        {
+            split += step;
+        }
+    } while (step > 1);
+
+    const int gamma = i + split * direction + std::min(direction, 0);
+
+    node.first    = (unsigned)std::min(i, j);
+    node.last     = (unsigned)std::max(i, j);
+    node.child[0] = (unsigned)gamma;
+    node.leaf[0]  = (int)node.first == gamma;
+    node.child[1] = (unsigned)gamma + 1;
+    node.leaf[1]  = (int)node.last == gamma + 1;
+}
+
+void Morton::buildHierarchy(const std::vector<Item>& items, std::vector<Node>& nodes)
+{
+    const int count  = (int)items.size();
+    const int blocks = (count - 1 + TASK_SIZE - 1) / TASK_SIZE;
+
+    nodes.resize(std::max(count - 1, 0));
+
+    forEachBlock(blocks, [&](int b) {
+            for (int i = blockBegin(count - 1, blocks, b); i < blockBegin(count - 1, blocks, b + 1); i++)
+            {
+                buildNode(items, nodes[i], i);
+            }
+        });
+}
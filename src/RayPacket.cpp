@@ -0,0 +1,69 @@
+#include "RayPacket.h"
+
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+
+void RayPacket::add(const Ray& ray)
+{
+    assert(count < MAX_SIZE);
+
+    if (count == 0)
+    {
+        coherent        = true;
+        minOrigin       = maxOrigin       = ray.origin;
+        minInvDirection = maxInvDirection = ray.direction_inv;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            negative[axis] = ray.sign[axis];
+        }
+    }
+
+    rays[count++] = ray;
+
+    minOrigin       = glm::min(minOrigin, ray.origin);
+    maxOrigin       = glm::max(maxOrigin, ray.origin);
+    minInvDirection = glm::min(minInvDirection, ray.direction_inv);
+    maxInvDirection = glm::max(maxInvDirection, ray.direction_inv);
+
+    // A zero direction component gives an infinite inverse, which the interval
+    // products below cannot handle
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if ((ray.sign[axis] != negative[axis]) ||
+            !std::isfinite(ray.direction_inv[axis]))
+        {
+            coherent = false;
+        }
+    }
+}
+
+// The distance to a plane, (plane - origin) * invDirection, is monotonic in
+// both factors for a fixed sign of the inverse direction, so over the packet
+// it lies between the products of the interval ends
+bool RayPacket::misses(const AABB& box) const
+{
+    float tEntry = 0.0f;
+    float tExit  = INFINITY;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        const float nearPlane = negative[axis] ? box.getMax()[axis] : box.getMin()[axis];
+        const float farPlane  = negative[axis] ? box.getMin()[axis] : box.getMax()[axis];
+        const float invLo     = minInvDirection[axis];
+        const float invHi     = maxInvDirection[axis];
+
+        const float nearLo = nearPlane - maxOrigin[axis];
+        const float nearHi = nearPlane - minOrigin[axis];
+        const float farLo  = farPlane - maxOrigin[axis];
+        const float farHi  = farPlane - minOrigin[axis];
+
+        tEntry = std::max(tEntry, std::min(std::min(nearLo * invLo, nearLo * invHi),
+                                           std::min(nearHi * invLo, nearHi * invHi)));
+        tExit = std::min(tExit, std::max(std::max(farLo * invLo, farLo * invHi),
+                                         std::max(farHi * invLo, farHi * invHi)));
+    }
+
+    return tEntry > tExit;
+}
@@ -0,0 +1,35 @@
+#include "RayStats.h"
+
+#ifdef TRACER_STATS
+
+#include <atomic>
+#include <algorithm>
+
+namespace RayStats {
+thread_local Counters local;
+
+static std::atomic<unsigned long long> totalRays(0);
+static std::atomic<unsigned long long> totalNodes(0);
+static std::atomic<unsigned long long> totalTriangles(0);
+
+void flush()
+{
+    totalRays      += local.rays;
+    totalNodes     += local.nodes;
+    totalTriangles += local.triangles;
+    local           = Counters();
+}
+
+void print(std::ostream& out)
+{
+    flush();
+
+    const double rays = (double)std::max(1ULL, totalRays.load());
+
+    out << "Rays: " << totalRays
+        << ", nodes visited per ray: " << totalNodes / rays
+        << ", triangle tests per ray: " << totalTriangles / rays << std::endl;
+}
+} // namespace RayStats
+
+#endif // ifdef TRACER_STATS
@@ -3,40 +3,345 @@
 #include <algorithm>
 
 #include "Math.hpp"
+#include "Morton.h"
+#include "RayStats.h"
 
 static const float RAY_EPSILON = 0.001f;
 
-Renderer::Renderer(const Scene& _scene, const unsigned int maxDepth) : maxDepth(maxDepth), scene(_scene)
+Renderer::Renderer(const Scene& _scene, const unsigned int maxDepth, const unsigned int rouletteDepth)
+    : maxDepth(maxDepth), rouletteDepth(rouletteDepth), scene(_scene)
 {}
 
-glm::vec3 Renderer::traceRay(const Ray& _ray, const unsigned int currentDepth) const
+glm::vec3 Renderer::traceRay(const Ray       & ray,
+                             const Random    & random,
+                             const unsigned int startDepth,
+                             const glm::vec3 & startWeight) const
 {
-    if (currentDepth == maxDepth)
+    // One stack per thread, kept between calls so its storage is allocated
+    // once. A call only pops what it pushed above base.
+    static thread_local std::vector<PathRay> paths;
+
+    const size_t base  = paths.size();
+    glm::vec3    color = glm::vec3(0);
+
+    if (startDepth < maxDepth)
+    {
+        paths.push_back(PathRay{ ray, startWeight, 0, startDepth, random });
+    }
+
+    while (paths.size() > base)
+    {
+        PathRay path = paths.back();
+        paths.pop_back();
+
+        // Epsilon: avoid self intersection
+        const Ray offsetRay(path.ray.origin + RAY_EPSILON * path.ray.direction, path.ray.direction);
+
+        // See if our current ray hits anything in the scene
+        float intersectedDistance;
+        unsigned int intersectedTriangleID, intersectedGroupID;
+        const bool   intersectionFound = scene.rayCast(offsetRay, intersectedGroupID, intersectedTriangleID,
+                                                       intersectedDistance);
+
+        // If the ray doesn't intersect, it brings no light
+        if (!intersectionFound)
+        {
+            continue;
+        }
+
+        // Secondary rays carry the throughput of the path on to the stack
+        color += path.weight * shade(offsetRay, intersectedGroupID, intersectedTriangleID, intersectedDistance,
+                                     path.depth, path.random,
+                                     [&](const Ray& secondary, unsigned int depth, const glm::vec3& weight) {
+                glm::vec3 throughput = path.weight * weight;
+
+                if (continuePath(depth, throughput, path.random))
+                {
+                    paths.push_back(PathRay{ secondary, throughput, 0, depth, path.random.split() });
+                }
+
+                return glm::vec3(0);
+            });
+    }
+
+    return color;
+}
+
+bool Renderer::continuePath(unsigned int depth, glm::vec3& weight, Random& random) const
+{
+    if (depth >= maxDepth)
+    {
+        return false;
+    }
+
+    if (depth < rouletteDepth)
+    {
+        return true;
+    }
+
+    const float survival = std::min(1.0f, std::max(weight.x, std::max(weight.y, weight.z)));
+
+    if ((survival <= 0.0f) || (random.nextFloat() >= survival))
+    {
+        return false;
+    }
+
+    weight /= survival;
+
+    return true;
+}
+
+void Renderer::getPixelColors(const RayPacket& packet, Random* randoms, glm::vec3* colors) const
+{
+    RayPacket offsetPacket;
+
+    for (unsigned i = 0; i < packet.size(); i++)
+    {
+        // Epsilon: avoid self intersection, as in traceRay
+        offsetPacket.add(Ray(packet[i].origin + RAY_EPSILON * packet[i].direction, packet[i].direction));
+    }
+
+    // Divergent packets fall back to single rays
+    if ((maxDepth == 0) || !offsetPacket.isCoherent())
+    {
+        for (unsigned i = 0; i < packet.size(); i++)
+        {
+            colors[i] = traceRay(packet[i], randoms[i]);
+        }
+
+        return;
+    }
+
+    float        distances[RayPacket::MAX_SIZE];
+    unsigned int groupIDs[RayPacket::MAX_SIZE], triangleIDs[RayPacket::MAX_SIZE];
+    const uint64_t hits = scene.rayCastPacket(offsetPacket, groupIDs, triangleIDs, distances);
+
+    for (unsigned i = 0; i < packet.size(); i++)
+    {
+        Random& random = randoms[i];
+
+        const auto recurse = [&](const Ray& secondary, unsigned int depth, const glm::vec3& weight) {
+                glm::vec3 throughput = weight;
+
+                return continuePath(depth, throughput, random)
+                       ? traceRay(secondary, random.split(), depth, throughput)
+                       : glm::vec3(0);
+            };
+
+        colors[i] = (hits & ((uint64_t)1 << i))
+                    ? shade(offsetPacket[i], groupIDs[i], triangleIDs[i], distances[i], 0, random, recurse)
+                    : glm::vec3(0);
+    }
+}
+
+// Origins are quantized to this many bits per axis, below the 3 octant bits
+static const int SORT_BITS_PER_AXIS = 10;
+
+// Rays shaded together by one thread in the wavefront integrator
+static const int SHADE_CHUNK_SIZE = 256;
+
+void Renderer::sortRays(std::vector<PathRay>& rays)
+{
+    std::vector<glm::vec3> origins(rays.size());
+    std::vector<Morton::Item> items;
+    AABB bounds = AABB::empty();
+
+    for (size_t i = 0; i < rays.size(); i++)
+    {
+        origins[i] = rays[i].ray.origin;
+        bounds.expand(origins[i]);
+    }
+
+    Morton::encode(origins, bounds, SORT_BITS_PER_AXIS, items);
+
+    for (auto& item : items)
+    {
+        const glm::vec3& direction = rays[item.index].ray.direction;
+        const uint64_t   octant    = (direction.x < 0.0f) << 2 | (direction.y < 0.0f) << 1 | (direction.z < 0.0f);
+
+        item.code |= octant << (3 * SORT_BITS_PER_AXIS);
+    }
+
+#pragma omp parallel
+#pragma omp single
+    Morton::sort(items, 3 * SORT_BITS_PER_AXIS + 3);
+
+    std::vector<PathRay> sorted(rays.size());
+
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        sorted[i] = rays[items[i].index];
+    }
+
+    rays.swap(sorted);
+}
+
+void Renderer::traceWavefront(std::vector<PathRay>& rays, glm::vec3* pixels) const
+{
+    struct Hit
+    {
+        bool         found;
+        unsigned int groupID;
+        unsigned int triangleID;
+        float        distance;
+    };
+
+    std::vector<Hit>       hits;
+    std::vector<glm::vec3> radiance;
+    std::vector<PathRay>   next;
+    std::vector<std::vector<PathRay> > spawned;
+
+    if (maxDepth == 0) rays.clear();
+
+    while (!rays.empty())
+    {
+        sortRays(rays);
+
+        const int count  = (int)rays.size();
+        const int chunks = (count + SHADE_CHUNK_SIZE - 1) / SHADE_CHUNK_SIZE;
+        hits.resize(rays.size());
+        radiance.assign(rays.size(), glm::vec3(0));
+        next.clear();
+        spawned.assign(chunks, std::vector<PathRay>());
+
+#pragma omp parallel
+        {
+            // Epsilon: avoid self intersection, as in traceRay
+#pragma omp for schedule(static)
+            for (int i = 0; i < count; i++)
+            {
+                Ray& ray = rays[i].ray;
+                ray = Ray(ray.origin + RAY_EPSILON * ray.direction, ray.direction);
+
+                hits[i].found = scene.rayCast(ray, hits[i].groupID, hits[i].triangleID, hits[i].distance);
+            }
+
+            // Secondary rays wait in a queue per chunk, joined in order, so
+            // the next wavefront does not depend on the threads
+#pragma omp for schedule(dynamic)
+            for (int chunk = 0; chunk < chunks; chunk++)
+            {
+                const int end = std::min(count, (chunk + 1) * SHADE_CHUNK_SIZE);
+
+                for (int i = chunk * SHADE_CHUNK_SIZE; i < end; i++)
+                {
+                    if (!hits[i].found) continue;
+
+                    PathRay& path = rays[i];
+
+                    radiance[i] = path.weight * shade(path.ray, hits[i].groupID, hits[i].triangleID,
+                                                      hits[i].distance, path.depth, path.random,
+                                                      [&](const Ray& secondary, unsigned int depth, const glm::vec3& weight) {
+                            glm::vec3 throughput = path.weight * weight;
+
+                            if (continuePath(depth, throughput, path.random))
+                            {
+                                spawned[chunk].push_back(PathRay{ secondary, throughput, path.pixel, depth,
+                                                                  path.random.split() });
+                            }
+
+                            return glm::vec3(0);
+                        });
+                }
+            }
+
+            RayStats::flush();
+        }
+
+        for (const auto& queue : spawned)
+        {
+            next.insert(next.end(), queue.begin(), queue.end());
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            pixels[rays[i].pixel] += radiance[i];
+        }
+
+        rays.swap(next);
+    }
+}
+
+glm::vec3 Renderer::sampleDirectLight(const Ray      & ray,
+                                      const glm::vec3& point,
+                                      const glm::vec3& normal,
+                                      const Material * material,
+                                      Random         & random) const
+{
+    LightSample light;
+
+    if (!scene.sampleLight(random, light))
+    {
+        return glm::vec3(0);
+    }
+
+    // Create a shadow ray
+    const glm::vec3 origin   = point + normal * RAY_EPSILON;
+    const float     distance = glm::length(light.position - origin);
+
+    if (distance <= RAY_EPSILON)
+    {
+        return glm::vec3(0);
+    }
+
+    const glm::vec3 shadowRayDirection = (light.position - origin) / distance;
+
+    if (glm::dot(shadowRayDirection, normal) < std::numeric_limits<float>::min())
     {
         return glm::vec3(0);
     }
 
-    // Epsilon: avoid self intersection
-    Ray ray(_ray.origin + RAY_EPSILON * _ray.direction, _ray.direction);
+    // The sampled triangle has to face the point, its pdf only holds for it
+    const float lightFactor = glm::dot(-shadowRayDirection, light.normal);
 
-    // See if our current ray hits anything in the scene
-    float intersectedDistance;
-    unsigned int intersectedTriangleID, intersectedGroupID;
-    const bool   intersectionFound = scene.rayCast(ray, intersectedGroupID, intersectedTriangleID, intersectedDistance);
+    if (lightFactor < std::numeric_limits<float>::min())
+    {
+        return glm::vec3(0);
+    }
 
-    // If the ray doesn't intersect, simply return (0, 0, 0)
-    if (!intersectionFound)
+    // Anything in front of the sampled point blocks it, including other
+    // triangles of the same light
+    const Ray shadowRay(origin, shadowRayDirection);
+
+    if (scene.occluded(shadowRay, distance - RAY_EPSILON))
     {
         return glm::vec3(0);
     }
 
+    // Dividing by the pdf sums over the emitting area, dividing by that area
+    // makes it the mean
+    const glm::vec3 radiance = lightFactor * light.mesh->material->getEmissionColor() /
+                               (light.pdf * scene.getEmissiveArea());
+
+    // Direct diffuse lighting.
+    glm::vec3 color = material->calcDiffuseLighting(-shadowRay.direction, -ray.direction, normal, radiance);
+
+    // Specular lighting.
+    if (material->isSpecular())
+    {
+        color += material->calcSpecularLighting(-shadowRay.direction, -ray.direction, normal, radiance);
+    }
+
+    return color;
+}
+
+// The returned color is linear in the radiance of every secondary ray, so each
+// one is handed to trace together with the factor it is seen through
+template<typename Trace>
+glm::vec3 Renderer::shade(const Ray  & ray,
+                          unsigned int intersectedGroupID,
+                          unsigned int intersectedTriangleID,
+                          float        intersectedDistance,
+                          unsigned int currentDepth,
+                          Random     & random,
+                          Trace        trace) const
+{
     // Calculate intersection point.
     const glm::vec3 intersectedPoint = ray.origin + ray.direction * intersectedDistance;
 
     // Retrieve primitive information for the intersected object
     const auto& intersectedGroup    = scene.getRenderGroup(intersectedGroupID);
-    const auto  intersectedTriangle = intersectedGroup.triangles[intersectedTriangleID];
-    const glm::vec3 hitNormal       = intersectedTriangle->getNormal(intersectedPoint);
+    const glm::vec3 hitNormal       = intersectedGroup.getNormal(intersectedTriangleID, intersectedPoint);
 
     // Back face culling
     if (glm::dot(-ray.direction, hitNormal) < std::numeric_limits<float>::min())
@@ -71,61 +376,7 @@ glm::vec3 Renderer::traceRay(const Ray& _ray, const unsigned int currentDepth) c
     // https://computergraphics.stackexchange.com/questions/5152/progressive-path-tracing-with-explicit-light-sampling
     if (shouldDiffuse)
     {
-        for (Mesh* lightSource : scene.getEmissiveMeshes())
-        {
-            // Create a shadow ray
-            const glm::vec3 randomLightSurfacePosition = lightSource->getRandomPositionOnSurface();
-            const glm::vec3 shadowRayDirection         = glm::normalize(randomLightSurfacePosition - intersectedPoint);
-
-            if (glm::dot(shadowRayDirection, hitNormal) < std::numeric_limits<float>::min())
-            {
-                continue;
-            }
-
-            const Ray shadowRay(intersectedPoint + hitNormal * RAY_EPSILON,
-                                shadowRayDirection);
-
-            // Cast the shadow ray towards the light source
-            unsigned int shadowMeshIndex, shadowRayTriangleIndex;
-
-            if (scene.rayCast(shadowRay, shadowMeshIndex, shadowRayTriangleIndex, intersectedDistance))
-            {
-                const auto& renderGroup = scene.getRenderGroup(shadowMeshIndex);
-
-                if (&renderGroup == lightSource)
-                {
-                    // We hit the light. Add it's contribution to the color
-                    // accumulator.
-                    const Triangle* lightTriangle = renderGroup.triangles[shadowRayTriangleIndex];
-                    const glm::vec3 lightNormal   = lightTriangle->getNormal(
-                        shadowRay.origin + intersectedDistance * shadowRay.direction);
-                    float lightFactor = glm::dot(-shadowRay.direction, lightNormal);
-
-                    if (lightFactor < std::numeric_limits<float>::min())
-                    {
-                        continue;
-                    }
-
-                    // Direct diffuse lighting.
-                    const glm::vec3 radiance = lightFactor * lightSource->material->getEmissionColor();
-                    colorAccumulator += hitMaterial->calcDiffuseLighting(
-                        -shadowRay.direction, -ray.direction, hitNormal, radiance);
-
-                    // Specular lighting.
-                    if (hitMaterial->isSpecular())
-                    {
-                        colorAccumulator += hitMaterial->calcSpecularLighting(
-                            -shadowRay.direction,
-                            -ray.direction,
-                            hitNormal,
-                            radiance);
-                    }
-                }
-            }
-        }
-
-        // Avoid over-lighting.
-        colorAccumulator /= glm::max<float>(1.0f, (float)scene.getEmissiveMeshes().size());
+        colorAccumulator += sampleDirectLight(ray, intersectedPoint, hitNormal, hitMaterial, random);
     }
 
     // Indirect lighting (diffuse light)
@@ -133,15 +384,17 @@ glm::vec3 Renderer::traceRay(const Ray& _ray, const unsigned int currentDepth) c
     {
         // Shoot rays and integrate diffuse lighting based on BRDF to compute
         // indirect lighting.
-        const glm::vec3 reflectionDirection = Math::sampleHemisphereWeighted(hitNormal);
-        const Ray  diffuseRay(intersectedPoint + hitNormal * RAY_EPSILON, reflectionDirection);
-        const auto incomingRadiance = traceRay(diffuseRay, currentDepth + 1);
-        colorAccumulator += hitMaterial->calcDiffuseLighting(
-            -diffuseRay.direction, -ray.direction,
-            hitNormal, incomingRadiance);
+        const glm::vec3 reflectionDirection = Math::sampleHemisphereWeighted(hitNormal, random);
+        const Ray diffuseRay(intersectedPoint + hitNormal * RAY_EPSILON, reflectionDirection);
 
         // Color blending when material is reflective or transparent
-        colorAccumulator *= (1.0f - hitMaterial->reflectivity) * (1.0f - hitMaterial->transparency);
+        const float blend = (1.0f - hitMaterial->reflectivity) * (1.0f - hitMaterial->transparency);
+
+        colorAccumulator *= blend;
+        colorAccumulator += trace(diffuseRay, currentDepth + 1,
+                                  blend * hitMaterial->calcDiffuseLighting(
+                                      -diffuseRay.direction, -ray.direction,
+                                      hitNormal, glm::vec3(1.0f)));
     }
 
     // Reflected light only
@@ -149,7 +402,7 @@ glm::vec3 Renderer::traceRay(const Ray& _ray, const unsigned int currentDepth) c
     {
         const glm::vec3 direction = glm::reflect(ray.direction, hitNormal);
         Ray reflectedRay(intersectedPoint + hitNormal * RAY_EPSILON, direction);
-        colorAccumulator += hitMaterial->reflectivity * traceRay(reflectedRay, currentDepth + 1);
+        colorAccumulator += trace(reflectedRay, currentDepth + 1, glm::vec3(hitMaterial->reflectivity));
     }
 
     // Refracted light + reflected light
@@ -159,41 +412,66 @@ glm::vec3 Renderer::traceRay(const Ray& _ray, const unsigned int currentDepth) c
         const float n1                     = 1.0f;
         const float n2                     = hitMaterial->refractiveIndex;
         const float schlickConstantOutside = Math::schlicksApprox(ray.direction, hitNormal, n1, n2);
-        Ray refractedRay(intersectedPoint - hitNormal * RAY_EPSILON, glm::refract(ray.direction, hitNormal, n1 / n2));
-        const float fRefracted = (1.0f - schlickConstantOutside) * hitMaterial->transparency;
-
-        if (scene.renderGroupRayCast(refractedRay, intersectedGroupID,
-                                     intersectedTriangleID, intersectedDistance))
+        float fRefracted                   = (1.0f - schlickConstantOutside) * hitMaterial->transparency;
+        float fReflected                   = schlickConstantOutside * hitMaterial->transparency;
+        bool  refract                      = true;
+        bool  reflect                      = true;
+
+        // Follow only one of the branches, picked with the probability of its
+        // Schlick weight, which then cancels out of its weight
+        if (fresnelSampling)
         {
-            // Self-intersected, cast ray from the exit point to the outer world and do refrection twice
-            const auto& refractedRayHitTriangle = intersectedGroup.triangles[intersectedTriangleID];
-            const glm::vec3 refractedPoint      = refractedRay.origin + refractedRay.direction * intersectedDistance;
-            const glm::vec3 refractedHitNormal  = refractedRayHitTriangle->getNormal(refractedPoint);
-            float schlickConstantInside         = Math::schlicksApprox(refractedRay.direction,
-                                                                       -refractedHitNormal,
-                                                                       n2,
-                                                                       n1);
-
-            const glm::vec3 direction = glm::refract(refractedRay.direction, -refractedHitNormal, n2 / n1);
-            Ray refractedRayOut(refractedPoint + RAY_EPSILON * refractedHitNormal, direction);
-            const float fRefractedIn = (1.0f - schlickConstantInside);
-
-            // Don't increase depth for refracted rays
-            auto incomingRadiance = fRefractedIn * traceRay(refractedRayOut, currentDepth);
-            colorAccumulator += fRefracted * hitMaterial->calcDiffuseLighting(
-                refractedRay.direction, -ray.direction, hitNormal, incomingRadiance);
+            refract    = random.nextFloat() >= schlickConstantOutside;
+            reflect    = !refract;
+            fRefracted = fReflected = hitMaterial->transparency;
         }
-        else
+
+        if (refract)
         {
-            // Not self-intersected, refract only once
-            colorAccumulator += fRefracted * traceRay(refractedRay, currentDepth + 1);
+            Ray refractedRay(intersectedPoint - hitNormal * RAY_EPSILON, glm::refract(ray.direction, hitNormal, n1 / n2));
+
+            if (scene.renderGroupRayCast(refractedRay, intersectedGroupID,
+                                         intersectedTriangleID, intersectedDistance))
+            {
+                // Self-intersected, cast ray from the exit point to the outer world and do refrection twice
+                const glm::vec3 refractedPoint      = refractedRay.origin + refractedRay.direction * intersectedDistance;
+                const glm::vec3 refractedHitNormal  = intersectedGroup.getNormal(intersectedTriangleID,
+                                                                                 refractedPoint);
+                float schlickConstantInside         = Math::schlicksApprox(refractedRay.direction,
+                                                                           -refractedHitNormal,
+                                                                           n2,
+                                                                           n1);
+
+                const glm::vec3 direction = glm::refract(refractedRay.direction, -refractedHitNormal, n2 / n1);
+
+                // glm::refract gives NaN on total internal reflection, such a ray
+                // would not hit anything
+                if (!glm::any(glm::isnan(direction)))
+                {
+                    Ray refractedRayOut(refractedPoint + RAY_EPSILON * refractedHitNormal, direction);
+                    const float fRefractedIn = (1.0f - schlickConstantInside);
+
+                    // Don't increase depth for refracted rays
+                    colorAccumulator += trace(refractedRayOut, currentDepth,
+                                              fRefracted * hitMaterial->calcDiffuseLighting(
+                                                  refractedRay.direction, -ray.direction,
+                                                  hitNormal, glm::vec3(fRefractedIn)));
+                }
+            }
+            else
+            {
+                // Not self-intersected, refract only once
+                colorAccumulator += trace(refractedRay, currentDepth + 1, glm::vec3(fRefracted));
+            }
         }
 
         // The remaining ray is reflected
-        auto outDirection = glm::reflect(ray.direction, hitNormal);
-        Ray  specularRay(intersectedPoint + hitNormal * RAY_EPSILON, outDirection);
-        const float fReflected = schlickConstantOutside * hitMaterial->transparency;
-        colorAccumulator += fReflected * traceRay(specularRay, currentDepth + 1);
+        if (reflect)
+        {
+            auto outDirection = glm::reflect(ray.direction, hitNormal);
+            Ray  specularRay(intersectedPoint + hitNormal * RAY_EPSILON, outDirection);
+            colorAccumulator += trace(specularRay, currentDepth + 1, glm::vec3(fReflected));
+        }
     }
 
     return colorAccumulator;
@@ -0,0 +1,22 @@
+#include "Sampler.h"
+#include "SobolSampler.h"
+#include "HaltonSampler.h"
+#include "BlueNoiseSampler.h"
+
+std::shared_ptr<Sampler> Sampler::create(SamplerType type)
+{
+    switch (type)
+    {
+    case SamplerType::Sobol:
+        return std::make_shared<SobolSampler>();
+
+    case SamplerType::Halton:
+        return std::make_shared<HaltonSampler>();
+
+    case SamplerType::BlueNoise:
+        return std::make_shared<BlueNoiseSampler>();
+
+    default:
+        return nullptr;
+    }
+}
@@ -4,6 +4,10 @@
 #include <limits>
 #include <exception>
 #include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
 
 #include <glm/gtx/norm.hpp>
 #include <glm/gtx/rotate_vector.hpp>
@@ -12,6 +16,9 @@
 #include <tiny_obj_loader/tiny_obj_loader.h>
 
 #include "Material.hpp"
+#include "RayStats.h"
+#include "SceneCache.h"
+#include "KDTree.h"
 
 inline glm::vec3 toVec3(const std::vector<tinyobj::real_t>& numbers)
 {
@@ -112,28 +119,27 @@ bool Scene::rayCast(const Ray   & ray,
 {
     float closestInterectionDistance = std::numeric_limits<float>::max();
 
-    // TODO: Use a BVH to avoid traversal
-    for (unsigned int i = 0; i < renderGroups.size(); ++i)
-    {
-        if (!renderGroups[i].enabled)
-        {
-            continue;
-        }
+    RayStats::countRay();
 
-        ObjectIntersection intersection = renderGroups[i].getIntersection(ray);
+    // Render groups are visited front to back, each one only has to find hits
+    // closer than the best so far
+    topLevel.traverse(ray, closestInterectionDistance, [&](unsigned int i, float& tMax) -> bool {
+            if (!renderGroups[i].enabled)
+            {
+                return false;
+            }
 
-        if (intersection.hit)
-        {
-            intersectionDistance = intersection.dist;
+            ObjectIntersection intersection = renderGroups[i].getIntersection(ray, tMax);
 
-            if (intersectionDistance < closestInterectionDistance)
+            if (intersection.hit)
             {
                 intersectionRenderGroupIndex = i;
                 intersectionTriangleIndex    = intersection.index;
-                closestInterectionDistance   = intersectionDistance;
+                tMax                         = intersection.dist;
             }
-        }
-    }
+
+            return false;
+        });
 
     intersectionDistance = closestInterectionDistance;
 
@@ -141,47 +147,122 @@ bool Scene::rayCast(const Ray   & ray,
            std::numeric_limits<float>::max() - std::numeric_limits<float>::min();
 }
 
+uint64_t Scene::rayCastPacket(const RayPacket& packet,
+                              unsigned int   * intersectionRenderGroupIndices,
+                              unsigned int   * intersectionTriangleIndices,
+                              float          * intersectionDistances) const
+{
+    uint64_t hits = 0;
+
+    for (unsigned i = 0; i < packet.size(); i++)
+    {
+        intersectionDistances[i] = std::numeric_limits<float>::max();
+
+        RayStats::countRay();
+    }
+
+    topLevel.traversePacket(packet, intersectionDistances, [&](unsigned int i, unsigned int first) {
+            if (!renderGroups[i].enabled)
+            {
+                return;
+            }
+
+            long     triangles[RayPacket::MAX_SIZE];
+            uint64_t groupHits = renderGroups[i].getPacketIntersection(packet, first, intersectionDistances,
+                                                                       triangles);
+
+            hits |= groupHits;
+
+            for (unsigned j = first; j < packet.size(); j++)
+            {
+                if (groupHits & ((uint64_t)1 << j))
+                {
+                    intersectionRenderGroupIndices[j] = i;
+                    intersectionTriangleIndices[j]    = triangles[j];
+                }
+            }
+        });
+
+    return hits;
+}
+
+bool Scene::occluded(const Ray& ray, float tMax) const
+{
+    bool blocked = false;
+
+    RayStats::countRay();
+
+    topLevel.traverse(ray, tMax, [&](unsigned int i, float& tMax) -> bool {
+            blocked = renderGroups[i].enabled && renderGroups[i].isOccluded(ray, tMax);
+
+            return blocked;
+        });
+
+    return blocked;
+}
+
 bool Scene::renderGroupRayCast(const Ray   & ray,
                                unsigned int  renderGroupIndex,
                                unsigned int& intersectionTriangleIndex,
                                float       & intersectionDistance) const
 {
-    float closestInterectionDistance = std::numeric_limits<float>::max();
-    const auto& renderGroup          = renderGroups[renderGroupIndex];
+    RayStats::countRay();
 
-    for (unsigned int j = 0; j < renderGroup.triangles.size(); ++j)
+    // Goes through the tree of the group, shared with its instances and cache
+    const ObjectIntersection intersection = renderGroups[renderGroupIndex].getIntersection(ray);
+
+    if (!intersection.hit)
     {
-        if (!renderGroup.triangles[j]->enabled)
-        {
-            continue;
-        }
+        return false;
+    }
 
-        bool intersects = renderGroup.triangles[j]->rayIntersection(ray,
-                                                                    intersectionDistance);
+    intersectionTriangleIndex = intersection.index;
+    intersectionDistance      = intersection.dist;
 
-        if (intersects)
-        {
-            assert(intersectionDistance > std::numeric_limits<float>::min());
+    return true;
+}
 
-            if (intersectionDistance < closestInterectionDistance)
-            {
-                intersectionTriangleIndex  = j;
-                closestInterectionDistance = intersectionDistance;
-            }
-        }
+unsigned Scene::addObj(std::string filePath,
+                       glm::vec3   translate,
+                       glm::vec3   rotate,
+                       glm::vec3   scale)
+{
+    const unsigned first = (unsigned)renderGroups.size();
+
+    auto object = objects.find(filePath);
+
+    if (object == objects.end())
+    {
+        object = objects.emplace(filePath, loadObj(filePath)).first;
     }
 
-    intersectionDistance = closestInterectionDistance;
+    glm::mat4 modelMatrix;
+    modelMatrix = glm::translate(modelMatrix, translate);
+    modelMatrix = glm::scale(modelMatrix, scale);
+    modelMatrix = glm::rotate(modelMatrix, glm::radians(rotate.x), glm::vec3(1, 0, 0));
+    modelMatrix = glm::rotate(modelMatrix, glm::radians(rotate.y), glm::vec3(0, 1, 0));
+    modelMatrix = glm::rotate(modelMatrix, glm::radians(rotate.z), glm::vec3(0, 0, 1));
 
-    return closestInterectionDistance <
-           std::numeric_limits<float>::max() - std::numeric_limits<float>::min();
+    for (const auto& mesh : object->second)
+    {
+        renderGroups.push_back(mesh.instance(modelMatrix));
+    }
+
+    return first;
 }
 
-void Scene::addObj(std::string filePath,
-                   glm::vec3   translate,
-                   glm::vec3   rotate,
-                   glm::vec3   scale)
+std::vector<Mesh> Scene::loadObj(const std::string& filePath)
 {
+    std::vector<Mesh> meshes;
+    const uint64_t cacheKey = cacheDirectory.empty()
+                              ? 0
+                              : SceneCache::computeKey(filePath, buildOptions);
+
+    if (cacheKey && loadCache(cacheKey, meshes))
+    {
+        return meshes;
+    }
+
     tinyobj::attrib_t attrib;
     std::vector<tinyobj::shape_t>    shapes;
     std::vector<tinyobj::material_t> materials;
@@ -193,12 +274,6 @@ void Scene::addObj(std::string filePath,
     mtlbasepath = filePath.substr(0, pos + 1);
 
     bool res = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filePath.c_str(), mtlbasepath.c_str());
-    glm::mat4 modelMatrix;
-    modelMatrix = glm::translate(modelMatrix, translate);
-    modelMatrix = glm::scale(modelMatrix, scale);
-    modelMatrix = glm::rotate(modelMatrix, glm::radians(rotate.x), glm::vec3(1, 0, 0));
-    modelMatrix = glm::rotate(modelMatrix, glm::radians(rotate.y), glm::vec3(0, 1, 0));
-    modelMatrix = glm::rotate(modelMatrix, glm::radians(rotate.z), glm::vec3(0, 0, 1));
 
     if (!warn.empty())
     {
@@ -213,19 +288,163 @@ void Scene::addObj(std::string filePath,
     {
         throw std::exception();
     }
-    else
+
+    for (const auto& shape : shapes)
+    {
+        meshes.push_back(loadMesh(attrib, shape.mesh, materials, glm::mat4()));
+    }
+
+    if (cacheKey)
+    {
+        pendingCaches.push_back(PendingCache{ cacheKey, meshes });
+    }
+
+    return meshes;
+}
+
+bool Scene::loadCache(uint64_t key, std::vector<Mesh>& meshes)
+{
+    std::unique_ptr<MappedFile> file(new MappedFile(SceneCache::fileName(cacheDirectory, key)));
+
+    if (!file->isOpen()) return false;
+
+    const SceneCache::Header* header = SceneCache::validate(file->data(), file->size(), key);
+
+    if (!header) return false;
+
+    const auto* records = reinterpret_cast<const SceneCache::MeshRecord *>(header + 1);
+
+    for (uint32_t m = 0; m < header->meshCount; m++)
     {
-        for (const auto& shape : shapes)
+        const SceneCache::MeshRecord& record = records[m];
+        LambertianMaterial* meshMaterial     = new LambertianMaterial(
+            glm::vec3(record.color[0], record.color[1], record.color[2]),
+            record.emissivity,
+            record.reflectivity,
+            record.transparency,
+            record.refractiveIndex,
+            record.specularity,
+            record.specularExponent);
+
+        materials.push_back(meshMaterial);
+
+        // The triangles are used in place and never written to
+        auto geometry             = std::make_shared<MeshGeometry>();
+        const Triangle* triangles = reinterpret_cast<const Triangle *>(file->data() + record.triangleOffset);
+
+        geometry->box = AABB(glm::vec3(record.boxMin[0], record.boxMin[1], record.boxMin[2]),
+                              glm::vec3(record.boxMax[0], record.boxMax[1], record.boxMax[2]));
+
+        for (uint64_t i = 0; i < record.triangleCount; i++)
         {
-            addMesh(attrib, shape.mesh, materials, modelMatrix);
+            geometry->triangles.push_back(const_cast<Triangle *>(triangles + i));
         }
+
+        if (record.nodeCount > 0)
+        {
+            geometry->tree = std::make_shared<KDTree>(
+                ArrayView<KDTreeNode>(reinterpret_cast<const KDTreeNode *>(file->data() + record.nodeOffset),
+                                      record.nodeCount),
+                ArrayView<TrianglePacket>(reinterpret_cast<const TrianglePacket *>(file->data() + record.packetOffset),
+                                          record.packetCount));
+            treeStats.add(geometry->tree->getStats());
+        }
+
+        Mesh meshGroup(meshMaterial, geometry);
+        meshGroup.box = geometry->box;
+        meshes.push_back(meshGroup);
     }
+
+    mappedCaches.push_back(std::move(file));
+
+    return true;
+}
+
+void Scene::saveCaches()
+{
+    static_assert(std::is_trivially_copyable<Triangle>::value, "Triangles are cached as plain bytes");
+
+    for (const auto& pending : pendingCaches)
+    {
+        SceneCache::Header header = {};
+        std::vector<SceneCache::MeshRecord> records(pending.meshes.size());
+        std::vector<char> buffer(sizeof(header) + records.size() * sizeof(SceneCache::MeshRecord));
+
+        for (size_t m = 0; m < records.size(); m++)
+        {
+            const MeshGeometry& geometry    = *pending.meshes[m].geometry;
+            const Material* material        = pending.meshes[m].material;
+            SceneCache::MeshRecord& record  = records[m];
+            std::vector<Triangle> triangles;
+
+            for (auto tri : geometry.triangles)
+            {
+                triangles.push_back(*tri);
+            }
+
+            for (int axis = 0; axis < 3; axis++)
+            {
+                record.color[axis]  = material->getSurfaceColor()[axis];
+                record.boxMin[axis] = geometry.box.getMin()[axis];
+                record.boxMax[axis] = geometry.box.getMax()[axis];
+            }
+
+            record.emissivity       = material->emissivity;
+            record.reflectivity     = material->reflectivity;
+            record.transparency     = material->transparency;
+            record.refractiveIndex  = material->refractiveIndex;
+            record.specularity      = material->specularity;
+            record.specularExponent = material->specularExponent;
+            record.triangleCount    = triangles.size();
+            record.triangleOffset   = SceneCache::append(buffer, triangles.data(),
+                                                         triangles.size() * sizeof(Triangle));
+
+            // Only the binary BVH is stored, other trees are built again
+            const KDTree* tree = dynamic_cast<const KDTree *>(geometry.tree.get());
+            const ArrayView<KDTreeNode> nodes       = tree ? tree->getNodes() : ArrayView<KDTreeNode>();
+            const ArrayView<TrianglePacket> packets = tree ? tree->getPackets() : ArrayView<TrianglePacket>();
+
+            record.nodeCount    = nodes.size();
+            record.nodeOffset   = SceneCache::append(buffer, nodes.data(), nodes.size() * sizeof(KDTreeNode));
+            record.packetCount  = packets.size();
+            record.packetOffset = SceneCache::append(buffer, packets.data(),
+                                                     packets.size() * sizeof(TrianglePacket));
+        }
+
+        memcpy(header.magic, "TRCACHE", 8);
+        header.version      = SceneCache::VERSION;
+        header.meshCount    = (uint32_t)records.size();
+        header.key          = pending.key;
+        header.triangleSize = sizeof(Triangle);
+        header.nodeSize     = sizeof(KDTreeNode);
+        header.packetSize   = sizeof(TrianglePacket);
+
+        memcpy(buffer.data(), &header, sizeof(header));
+        memcpy(buffer.data() + sizeof(header), records.data(), records.size() * sizeof(SceneCache::MeshRecord));
+
+        const std::string path = SceneCache::fileName(cacheDirectory, pending.key);
+
+        if (!SceneCache::write(path, buffer))
+        {
+            std::cout << "Could not write scene cache " << path << std::endl;
+        }
+    }
+
+    pendingCaches.clear();
 }
 
 void Scene::addMesh(const tinyobj::attrib_t               & attrib,
                     const tinyobj::mesh_t                 & mesh,
                     const std::vector<tinyobj::material_t>& objMaterials,
                     const glm::mat4                       & modelMatrix)
+{
+    renderGroups.push_back(loadMesh(attrib, mesh, objMaterials, modelMatrix));
+}
+
+Mesh Scene::loadMesh(const tinyobj::attrib_t               & attrib,
+                     const tinyobj::mesh_t                 & mesh,
+                     const std::vector<tinyobj::material_t>& objMaterials,
+                     const glm::mat4                       & modelMatrix)
 {
     const tinyobj::material_t* currentMaterial = &objMaterials[mesh.material_ids[0]];
 
@@ -234,23 +453,165 @@ void Scene::addMesh(const tinyobj::attrib_t               & attrib,
 
     materials.push_back(meshMaterial);
 
-    // New render group
-    Mesh meshGroup(meshMaterial);
+    // New geometry, shared by every instance of the mesh. Its triangles are
+    // stored next to each other in the arena.
+    auto geometry        = std::make_shared<MeshGeometry>();
+    const size_t count   = mesh.num_face_vertices.size();
+    Triangle   * storage = arena.allocateArray<Triangle>(count);
 
-    for (size_t i = 0; i < mesh.num_face_vertices.size(); i++)
+    for (size_t i = 0; i < count; i++)
     {
         int vertOffset = (int)i * 3;
-        Triangle* tri  = new Triangle(getFace(attrib, mesh, modelMatrix, vertOffset),
+        Triangle* tri  = new (storage + i)Triangle(getFace(attrib, mesh, modelMatrix, vertOffset),
                                       getFace(attrib, mesh, modelMatrix, vertOffset + 1),
                                       getFace(attrib, mesh, modelMatrix, vertOffset + 2),
                                       getNormal(attrib, mesh, modelMatrix, vertOffset),
                                       getNormal(attrib, mesh, modelMatrix, vertOffset + 1),
                                       getNormal(attrib, mesh, modelMatrix, vertOffset + 2),
-                                      (int)meshGroup.triangles.size());
-        meshGroup.triangles.push_back(tri);
+                                      (int)geometry->triangles.size());
+        geometry->triangles.push_back(tri);
     }
 
-    meshGroup.node = KDNode().build(meshGroup.triangles, 0);
+    geometry->box = AABB::empty();
+
+    for (auto tri : geometry->triangles)
+    {
+        geometry->box.expand(tri->getBoundingBox());
+    }
+
+    Mesh meshGroup(meshMaterial, geometry);
+    meshGroup.box = geometry->box;
+
+    return meshGroup;
+}
+
+bool Scene::update(float rebuildRatio)
+{
+    buildLightDistribution();
+
+    const std::vector<AABB> bounds = getBounds();
+
+    if (topLevel.refit(bounds) <= rebuildRatio) return false;
+
+    topLevel.build(bounds);
+
+    return true;
+}
+
+bool Scene::sampleLight(Random& random, LightSample& sample) const
+{
+    if (lightTable.empty()) return false;
+
+    const EmissiveTriangle& light = emissiveTriangles[lightTable.sample(random)];
+    const Mesh            & mesh  = renderGroups[light.renderGroupIndex];
+
+    // Uniform in object space is uniform in world space too, the transform
+    // scales all areas of a triangle alike
+    sample.mesh     = &mesh;
+    sample.position = mesh.pointToWorld(
+        mesh.geometry->triangles[light.index]->getRandomPositionOnSurface(random));
+    sample.normal   = mesh.getNormal(light.index, sample.position);
+    sample.pdf      = light.pdf;
+
+    return true;
+}
+
+void Scene::buildLightDistribution()
+{
+    std::vector<float> weights;
+    std::vector<float> areas;
+
+    emissiveTriangles.clear();
+    emissiveArea = 0.0f;
+
+    for (unsigned rg = 0; rg < renderGroups.size(); rg++)
+    {
+        const Mesh& mesh = renderGroups[rg];
+
+        if (!mesh.material->isEmissive()) continue;
+
+        const glm::vec3 emission  = mesh.material->getEmissionColor();
+        const float     power     = (emission.r + emission.g + emission.b) / 3.0f;
+        const auto    & triangles = mesh.geometry->triangles;
+
+        if (power <= 0.0f) continue;
+
+        for (unsigned i = 0; i < triangles.size(); i++)
+        {
+            const glm::vec3 v0   = mesh.pointToWorld(triangles[i]->vertices[0]);
+            const glm::vec3 v1   = mesh.pointToWorld(triangles[i]->vertices[1]);
+            const glm::vec3 v2   = mesh.pointToWorld(triangles[i]->vertices[2]);
+            const float     area = 0.5f * glm::length(glm::cross(v1 - v0, v2 - v0));
+
+            // Degenerate triangles could never be hit by a shadow ray
+            if (area <= 0.0f) continue;
+
+            emissiveTriangles.push_back(EmissiveTriangle{ rg, i, 0.0f });
+            weights.push_back(power * area);
+            areas.push_back(area);
+            emissiveArea += area;
+        }
+    }
+
+    if (emissiveTriangles.empty())
+    {
+        lightTable = AliasTable();
+
+        return;
+    }
+
+    lightTable = AliasTable(weights);
+
+    for (unsigned i = 0; i < emissiveTriangles.size(); i++)
+    {
+        emissiveTriangles[i].pdf = lightTable.getProbability(i) / areas[i];
+    }
+}
+
+std::vector<AABB> Scene::getBounds() const
+{
+    std::vector<AABB> bounds;
+
+    for (auto& rg : renderGroups)
+    {
+        bounds.push_back(rg.box);
+    }
+
+    return bounds;
+}
+
+void Scene::buildTrees()
+{
+    const auto startTime = std::chrono::high_resolution_clock::now();
+
+    // Instances share a tree, which is built once
+    std::vector<MeshGeometry *> pending;
+
+    for (auto& rg : renderGroups)
+    {
+        if (!rg.geometry->tree) pending.push_back(rg.geometry.get());
+    }
+
+    // Largest meshes first, so that no thread picks up a big one at the end
+    std::sort(pending.begin(), pending.end(), [](const MeshGeometry* a, const MeshGeometry* b) {
+            return (a->triangles.size() > b->triangles.size()) ||
+                   ((a->triangles.size() == b->triangles.size()) && (a < b));
+        });
+    pending.erase(std::unique(pending.begin(), pending.end()), pending.end());
+
+    // Threads waiting at the end of the loop pick up the subtree tasks of the
+    // meshes still being built
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int i = 0; i < (int)pending.size(); i++)
+    {
+        pending[i]->tree = Accelerator::build(pending[i]->triangles, buildOptions);
+    }
+
+    for (auto geometry : pending)
+    {
+        treeStats.add(geometry->tree->getStats());
+    }
 
-    renderGroups.push_back(meshGroup);
+    const auto endTime = std::chrono::high_resolution_clock::now();
+    buildTime = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count();
 }
@@ -0,0 +1,156 @@
+#include <vector>
+#include <numeric>
+#include <algorithm>
+
+#include "SceneBVH.h"
+
+// Below this depth splits are chosen by SAH, deeper than it by median so the
+// traversal stack can never overflow
+static const int SAH_DEPTH = 32;
+
+// Levels with fewer nodes are refit by one thread
+static const int PARALLEL_REFIT_SIZE = 256;
+
+void SceneBVH::build(const std::vector<AABB>& bounds)
+{
+    nodes.clear();
+    levels.clear();
+
+    if (bounds.empty()) return;
+
+    std::vector<unsigned> items(bounds.size());
+    std::iota(items.begin(), items.end(), 0);
+
+    nodes.reserve(2 * bounds.size());
+    nodes.push_back(Node());
+    buildNode(0, items, 0, items.size(), bounds, 0);
+
+    buildCost = getCost();
+}
+
+float SceneBVH::refit(const std::vector<AABB>& bounds)
+{
+    for (int depth = (int)levels.size() - 1; depth >= 0; depth--)
+    {
+        const std::vector<unsigned>& level = levels[depth];
+
+        #pragma omp parallel for if (level.size() >= PARALLEL_REFIT_SIZE)
+        for (int i = 0; i < (int)level.size(); i++)
+        {
+            Node& node = nodes[level[i]];
+
+            if (node.leaf)
+            {
+                node.box = bounds[node.offset];
+            }
+            else
+            {
+                node.box = nodes[node.offset].box;
+                node.box.expand(nodes[node.offset + 1].box);
+            }
+        }
+    }
+
+    return (buildCost > 0.0f) ? getCost() / buildCost : 1.0f;
+}
+
+float SceneBVH::getCost() const
+{
+    float area     = 0.0f;
+    float leafArea = 0.0f;
+
+    for (const Node& node : nodes)
+    {
+        area += node.box.getHalfArea();
+
+        if (node.leaf) leafArea += node.box.getHalfArea();
+    }
+
+    return (leafArea > 0.0f) ? area / leafArea : (float)nodes.size();
+}
+
+void SceneBVH::buildNode(unsigned                 nodeIndex,
+                         std::vector<unsigned>  & items,
+                         size_t                   begin,
+                         size_t                   end,
+                         const std::vector<AABB>& bounds,
+                         int                      depth)
+{
+    AABB box = AABB::empty();
+
+    for (size_t i = begin; i < end; i++)
+    {
+        box.expand(bounds[items[i]]);
+    }
+
+    nodes[nodeIndex].box = box;
+
+    if ((int)levels.size() <= depth) levels.resize(depth + 1);
+
+    levels[depth].push_back(nodeIndex);
+
+    if (end - begin == 1)
+    {
+        nodes[nodeIndex].leaf   = true;
+        nodes[nodeIndex].offset = items[begin];
+
+        return;
+    }
+
+    // There are few render groups, so a full sweep over every axis is cheap and
+    // gives the exact SAH split instead of a binned approximation
+    const size_t count    = end - begin;
+    size_t       bestMid  = begin + count / 2;
+    int          bestAxis = box.get_longest_axis();
+
+    if (depth < SAH_DEPTH)
+    {
+        std::vector<float> rightArea(count);
+        float bestCost = INFINITY;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            std::sort(items.begin() + begin, items.begin() + end, [&](unsigned a, unsigned b) {
+                    return bounds[a].getCenter()[axis] < bounds[b].getCenter()[axis];
+                });
+
+            AABB sweep = AABB::empty();
+
+            for (size_t i = count - 1; i > 0; i--)
+            {
+                sweep.expand(bounds[items[begin + i]]);
+                rightArea[i] = sweep.getHalfArea();
+            }
+
+            sweep = AABB::empty();
+
+            for (size_t i = 1; i < count; i++)
+            {
+                sweep.expand(bounds[items[begin + i - 1]]);
+
+                const float cost = sweep.getHalfArea() * i + rightArea[i] * (count - i);
+
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestMid  = begin + i;
+                }
+            }
+        }
+    }
+
+    std::sort(items.begin() + begin, items.begin() + end, [&](unsigned a, unsigned b) {
+            return bounds[a].getCenter()[bestAxis] < bounds[b].getCenter()[bestAxis];
+        });
+
+    const unsigned left = (unsigned)nodes.size();
+
+    nodes[nodeIndex].leaf   = false;
+    nodes[nodeIndex].offset = left;
+    nodes.push_back(Node());
+    nodes.push_back(Node());
+
+    buildNode(left, items, begin, bestMid, bounds, depth + 1);
+    buildNode(left + 1, items, bestMid, end, bounds, depth + 1);
+}
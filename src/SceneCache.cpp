@@ -0,0 +1,253 @@
+#include "SceneCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <random>
+
+#include "Triangle.h"
+#include "KDTree.h"
+#include "TrianglePackets.h"
+#include "MappedFile.h"
+
+static const char MAGIC[8] = { 'T', 'R', 'C', 'A', 'C', 'H', 'E', '\0' };
+
+static const size_t ALIGNMENT = 64;
+
+// 64 bit FNV-1a
+static const uint64_t HASH_SEED  = 0xcbf29ce484222325ull;
+static const uint64_t HASH_PRIME = 0x100000001b3ull;
+
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char *>(data);
+
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * HASH_PRIME;
+    }
+
+    return hash;
+}
+
+template<typename T>
+static uint64_t hashValue(uint64_t hash, const T& value)
+{
+    return hashBytes(hash, &value, sizeof(value));
+}
+
+static bool readFile(const std::string& path, std::string& contents)
+{
+    std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+
+    if (!in) return false;
+
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    contents = buffer.str();
+
+    return true;
+}
+
+uint64_t SceneCache::computeKey(const std::string & objPath,
+                                const BuildOptions& options)
+{
+    std::string obj;
+
+    if (!readFile(objPath, obj)) return 0;
+
+    uint64_t hash = HASH_SEED;
+
+    hash = hashValue(hash, VERSION);
+    hash = hashBytes(hash, obj.data(), obj.size());
+
+    // Material libraries are looked up next to the OBJ file, like the loader does
+    const std::string baseDirectory = objPath.substr(0, objPath.find_last_of("/") + 1);
+    std::istringstream lines(obj);
+    std::string line;
+
+    while (std::getline(lines, line))
+    {
+        if (line.compare(0, 7, "mtllib ") != 0) continue;
+
+        std::string mtlName = line.substr(7);
+        mtlName.erase(mtlName.find_last_not_of(" \t\r") + 1);
+
+        std::string mtl;
+
+        if (readFile(baseDirectory + mtlName, mtl))
+        {
+            hash = hashBytes(hash, mtl.data(), mtl.size());
+        }
+    }
+
+    hash = hashValue(hash, (int)options.partitioning);
+    hash = hashValue(hash, (int)options.method);
+    hash = hashValue(hash, (int)options.layout);
+    hash = hashValue(hash, options.splitGrowth);
+    hash = hashValue(hash, options.width);
+
+    return hash;
+}
+
+std::string SceneCache::fileName(const std::string& directory, uint64_t key)
+{
+    std::ostringstream name;
+
+    name << directory;
+
+    if (!directory.empty() && (directory.back() != '/') && (directory.back() != '\\'))
+    {
+        name << '/';
+    }
+
+    name << std::hex << std::setw(16) << std::setfill('0') << key << ".cache";
+
+    return name.str();
+}
+
+static bool inFile(uint64_t offset, uint64_t count, size_t elementSize, size_t fileSize)
+{
+    return (offset % ALIGNMENT == 0) && (offset <= fileSize) &&
+           (count <= (fileSize - offset) / elementSize);
+}
+
+// Whether the stored tree of record only refers to its own nodes, packets and
+// triangles and fits the traversal stacks. Each node is reached at most once,
+// children always come after their parent in both layouts.
+static bool validTree(const char* data, const SceneCache::MeshRecord& record)
+{
+    const KDTreeNode    * nodes   = reinterpret_cast<const KDTreeNode *>(data + record.nodeOffset);
+    const TrianglePacket* packets = reinterpret_cast<const TrianglePacket *>(data + record.packetOffset);
+
+    for (uint64_t i = 0; i < record.packetCount; i++)
+    {
+        for (int slot = 0; slot < 4; slot++)
+        {
+            const int id = packets[i].id[slot];
+
+            if ((id < -1) || ((id >= 0) && ((uint64_t)id >= record.triangleCount))) return false;
+        }
+    }
+
+    if (record.nodeCount == 0) return true;
+
+    struct Entry
+    {
+        uint64_t node;
+        int      depth;
+    };
+
+    std::vector<bool>  reached(record.nodeCount, false);
+    std::vector<Entry> stack(1, Entry{ 0, 0 });
+
+    while (!stack.empty())
+    {
+        const Entry entry = stack.back();
+        stack.pop_back();
+
+        if (reached[entry.node]) return false;
+
+        reached[entry.node] = true;
+
+        const KDTreeNode& node = nodes[entry.node];
+
+        if (node.count > 0)
+        {
+            if ((uint64_t)node.offset + (node.count + 3) / 4 > record.packetCount) return false;
+
+            continue;
+        }
+
+        if ((entry.depth >= KDTree::MAX_DEPTH) || (node.offset <= entry.node) ||
+            ((uint64_t)node.offset + 1 >= record.nodeCount))
+        {
+            return false;
+        }
+
+        stack.push_back(Entry{ node.offset + 1, entry.depth + 1 });
+        stack.push_back(Entry{ node.offset, entry.depth + 1 });
+    }
+
+    return true;
+}
+
+const SceneCache::Header* SceneCache::validate(const char* data, size_t size, uint64_t key)
+{
+    if (size < sizeof(Header)) return nullptr;
+
+    const Header* header = reinterpret_cast<const Header *>(data);
+
+    if ((memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0) ||
+        (header->version != VERSION) ||
+        (header->key != key) ||
+        (header->triangleSize != sizeof(Triangle)) ||
+        (header->nodeSize != sizeof(KDTreeNode)) ||
+        (header->packetSize != sizeof(TrianglePacket)) ||
+        (header->meshCount > (size - sizeof(Header)) / sizeof(MeshRecord)))
+    {
+        return nullptr;
+    }
+
+    const MeshRecord* records = reinterpret_cast<const MeshRecord *>(header + 1);
+
+    for (uint32_t i = 0; i < header->meshCount; i++)
+    {
+        if (!inFile(records[i].triangleOffset, records[i].triangleCount, sizeof(Triangle), size) ||
+            !inFile(records[i].nodeOffset, records[i].nodeCount, sizeof(KDTreeNode), size) ||
+            !inFile(records[i].packetOffset, records[i].packetCount, sizeof(TrianglePacket), size) ||
+            !validTree(data, records[i]))
+        {
+            return nullptr;
+        }
+    }
+
+    return header;
+}
+
+uint64_t SceneCache::append(std::vector<char>& buffer, const void* data, size_t size)
+{
+    const size_t offset = (buffer.size() + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+
+    buffer.resize(offset + size);
+
+    if (size > 0) memcpy(&buffer[offset], data, size);
+
+    return offset;
+}
+
+bool SceneCache::write(const std::string& path, const std::vector<char>& buffer)
+{
+    std::random_device random;
+    const std::string  temporary = path + "." + std::to_string(random()) + ".tmp";
+
+    bool written;
+
+    {
+        std::ofstream out(temporary.c_str(), std::ios::out | std::ios::binary);
+
+        out.write(buffer.data(), buffer.size());
+        out.close();
+        written = !out.fail();
+    }
+
+    if (!written)
+    {
+        std::remove(temporary.c_str());
+
+        return false;
+    }
+
+    if (std::rename(temporary.c_str(), path.c_str()) == 0) return true;
+
+    std::remove(temporary.c_str());
+
+    // Fails on Windows when another process got there first, whose file is
+    // just as good if it is a complete cache for the same key
+    const uint64_t key = reinterpret_cast<const Header *>(buffer.data())->key;
+    MappedFile     existing(path);
+
+    return existing.isOpen() && (validate(existing.data(), existing.size(), key) != nullptr);
+}
@@ -0,0 +1,40 @@
+#include "Simd.h"
+
+#ifdef _MSC_VER
+# include <intrin.h>
+#endif
+
+namespace Simd {
+static bool detectAVX2()
+{
+#ifdef _MSC_VER
+    int info[4];
+
+    __cpuid(info, 0);
+
+    if (info[0] < 7) return false;
+
+    // AVX registers must be enabled by the OS
+    __cpuid(info, 1);
+
+    if (((info[2] >> 27) & 1) == 0 || ((info[2] >> 28) & 1) == 0) return false;
+
+    if ((_xgetbv(0) & 6) != 6) return false;
+
+    __cpuidex(info, 7, 0);
+
+    return ((info[1] >> 5) & 1) != 0;
+#else
+    __builtin_cpu_init();
+
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+bool hasAVX2()
+{
+    static const bool supported = detectAVX2();
+
+    return supported;
+}
+} // namespace Simd
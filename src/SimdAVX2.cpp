@@ -0,0 +1,122 @@
+#include "Simd.h"
+
+#include <cfloat>
+#include <cmath>
+
+#include <immintrin.h>
+
+// Built with AVX2 enabled. Keep everything here self-contained, see Simd.h.
+
+namespace Simd {
+int intersectBoxes8AVX2(const float* bounds, const SimdRay& ray, float tMax, float* tEntry)
+{
+    __m256 tNear = _mm256_setzero_ps();
+    __m256 tFar  = _mm256_set1_ps(tMax);
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        const __m256 origin = _mm256_set1_ps(ray.origin[axis]);
+        const __m256 inv    = _mm256_set1_ps(ray.invDirection[axis]);
+        const __m256 near   = _mm256_load_ps(bounds + (ray.sign[axis] * 3 + axis) * 8);
+        const __m256 far    = _mm256_load_ps(bounds + ((1 - ray.sign[axis]) * 3 + axis) * 8);
+
+        // The slab distance goes first: max and min return the second operand
+        // when one is NaN, which happens for 0 * inf on a box plane
+        tNear = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(near, origin), inv), tNear);
+        tFar  = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(far, origin), inv), tFar);
+    }
+
+    _mm256_storeu_ps(tEntry, tNear);
+
+    return _mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ));
+}
+
+// Row of a triangle packet pair, the second packet missing for an odd count
+static inline __m256 loadRow(const float* first, const float* second, int row)
+{
+    const __m128 low  = _mm_load_ps(first + row * 4);
+    const __m128 high = second ? _mm_load_ps(second + row * 4) : _mm_set1_ps(NAN);
+
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(low), high, 1);
+}
+
+// Same steps as Triangle::intersect, a NaN anywhere fails the comparisons
+int intersectTriangles8AVX2(const float* packets, unsigned count, const SimdRay& ray, float& tMax)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one  = _mm256_set1_ps(1.0f);
+    const __m256 dx   = _mm256_set1_ps(ray.direction[0]);
+    const __m256 dy   = _mm256_set1_ps(ray.direction[1]);
+    const __m256 dz   = _mm256_set1_ps(ray.direction[2]);
+    int          hit  = -1;
+
+    for (unsigned packet = 0; packet < count; packet += 2)
+    {
+        const float* first  = packets + packet * TRIANGLE_PACKET_FLOATS;
+        const float* second = packet + 1 < count ? first + TRIANGLE_PACKET_FLOATS : nullptr;
+
+        const __m256 e1x = loadRow(first, second, 3);
+        const __m256 e1y = loadRow(first, second, 4);
+        const __m256 e1z = loadRow(first, second, 5);
+        const __m256 e2x = loadRow(first, second, 6);
+        const __m256 e2y = loadRow(first, second, 7);
+        const __m256 e2z = loadRow(first, second, 8);
+
+        // P = cross(direction, e2)
+        const __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+        const __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+        const __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+
+        // T = origin - v0
+        const __m256 tx = _mm256_sub_ps(_mm256_set1_ps(ray.origin[0]), loadRow(first, second, 0));
+        const __m256 ty = _mm256_sub_ps(_mm256_set1_ps(ray.origin[1]), loadRow(first, second, 1));
+        const __m256 tz = _mm256_sub_ps(_mm256_set1_ps(ray.origin[2]), loadRow(first, second, 2));
+
+        const __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)),
+                                         _mm256_mul_ps(e1z, pz));
+        const __m256 inv = _mm256_div_ps(one, det);
+        const __m256 u   = _mm256_mul_ps(inv, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, px),
+                                                                          _mm256_mul_ps(ty, py)),
+                                                            _mm256_mul_ps(tz, pz)));
+
+        __m256 valid = _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ));
+
+        if (_mm256_movemask_ps(valid) == 0) continue;
+
+        // Q = cross(T, e1)
+        const __m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(tz, e1y));
+        const __m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(tx, e1z));
+        const __m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(ty, e1x));
+
+        const __m256 v = _mm256_mul_ps(inv, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx),
+                                                                        _mm256_mul_ps(dy, qy)),
+                                                          _mm256_mul_ps(dz, qz)));
+        const __m256 t = _mm256_mul_ps(inv, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx),
+                                                                        _mm256_mul_ps(e2y, qy)),
+                                                          _mm256_mul_ps(e2z, qz)));
+
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(FLT_MIN), _CMP_GT_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(tMax), _CMP_LT_OQ));
+
+        const int mask = _mm256_movemask_ps(valid);
+
+        if (mask == 0) continue;
+
+        float distances[8];
+        _mm256_storeu_ps(distances, t);
+
+        for (int lane = 0; lane < 8; lane++)
+        {
+            if ((mask & (1 << lane)) && (distances[lane] < tMax))
+            {
+                tMax = distances[lane];
+                hit  = (int)packet * 4 + lane;
+            }
+        }
+    }
+
+    return hit;
+}
+} // namespace Simd
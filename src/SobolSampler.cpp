@@ -0,0 +1,98 @@
+#include "SobolSampler.h"
+
+// Primitive polynomials and initial direction numbers of the Sobol dimensions
+// after the first, from the new-joe-kuo-6.21201 table. The first dimension is
+// the van der Corput sequence.
+static const struct
+{
+    int      degree;
+    uint32_t coefficients;
+    uint32_t initial[3];
+} POLYNOMIALS[] = {
+    { 1, 0, { 1 } }
+};
+
+static uint32_t reverseBits(uint32_t x)
+{
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+
+    return (x >> 16) | (x << 16);
+}
+
+SobolSampler::SobolSampler(uint32_t seed, bool perPixel)
+    : seed(seed), perPixel(perPixel)
+{
+    for (int bit = 0; bit < 32; bit++)
+    {
+        directions[0][bit] = 1u << (31 - bit);
+    }
+
+    for (int dimension = 1; dimension < SOBOL_DIMENSIONS; dimension++)
+    {
+        const auto& polynomial = POLYNOMIALS[dimension - 1];
+        const int   degree     = polynomial.degree;
+        uint32_t  * v          = directions[dimension];
+
+        for (int bit = 0; bit < 32; bit++)
+        {
+            if (bit < degree)
+            {
+                v[bit] = polynomial.initial[bit] << (31 - bit);
+
+                continue;
+            }
+
+            v[bit] = v[bit - degree] ^ (v[bit - degree] >> degree);
+
+            for (int k = 1; k < degree; k++)
+            {
+                if ((polynomial.coefficients >> (degree - 1 - k)) & 1)
+                {
+                    v[bit] ^= v[bit - k];
+                }
+            }
+        }
+    }
+}
+
+uint32_t SobolSampler::sample(uint32_t index, uint32_t dimension, uint32_t x, uint32_t y) const
+{
+    const uint32_t pixelSeed = perPixel ? hash(hash(x, seed), y) : seed;
+    const uint32_t groupSeed = hash(dimension / SOBOL_DIMENSIONS, pixelSeed);
+    const uint32_t shuffled  = nestedUniformScramble(index, groupSeed);
+    const int      axis      = dimension % SOBOL_DIMENSIONS;
+
+    return nestedUniformScramble(sobol(shuffled, axis), hash(axis, groupSeed));
+}
+
+uint32_t SobolSampler::sobol(uint32_t index, int dimension) const
+{
+    uint32_t value = 0;
+
+    // The shuffled indices use all 32 bits at random, so this masks rather
+    // than branches on each of them
+    for (int bit = 0; bit < 32; bit++, index >>= 1)
+    {
+        value ^= directions[dimension][bit] & (0u - (index & 1));
+    }
+
+    return value;
+}
+
+// The Laine-Karras permutation only lets lower bits change higher ones, which
+// on the reversed bits gives a scramble where each bit depends on the bits
+// above it alone, as Owen scrambling does
+uint32_t SobolSampler::nestedUniformScramble(uint32_t value, uint32_t seed)
+{
+    value  = reverseBits(value);
+    value += seed;
+    value ^= value * 0x6c50b47cu;
+    value ^= value * 0xb82f1e52u;
+    value ^= value * 0xc7afe638u;
+    value ^= value * 0x8d22f6e6u;
+
+    return reverseBits(value);
+}
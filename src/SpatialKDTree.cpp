@@ -0,0 +1,424 @@
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "SpatialKDTree.h"
+#include "RayStats.h"
+
+// Fraction of the intersection cost saved by a split that cuts off empty space
+static const float EMPTY_BONUS = 0.5f;
+
+static float halfArea(const glm::vec3& extent)
+{
+    return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+// Bounds of the part of tri inside box, found by clipping the triangle against
+// the six planes of the box. Returns false if nothing is left.
+static bool clipTriangle(const Triangle& tri, const AABB& box, AABB& clipped)
+{
+    // Every plane adds at most one vertex to the triangle
+    glm::vec3 polygon[2][9];
+    int       count   = 3;
+    int       current = 0;
+
+    for (int i = 0; i < 3; i++)
+    {
+        polygon[0][i] = tri.vertices[i];
+    }
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        for (int side = 0; side < 2; side++)
+        {
+            const float      plane = side ? box.getMax()[axis] : box.getMin()[axis];
+            const glm::vec3* in    = polygon[current];
+            glm::vec3      * out   = polygon[1 - current];
+            int              kept  = 0;
+
+            for (int i = 0; i < count; i++)
+            {
+                const glm::vec3& a = in[i];
+                const glm::vec3& b = in[(i + 1) % count];
+                const bool insideA = side ? a[axis] <= plane : a[axis] >= plane;
+                const bool insideB = side ? b[axis] <= plane : b[axis] >= plane;
+
+                if (insideA) out[kept++] = a;
+
+                if (insideA != insideB)
+                {
+                    glm::vec3 p = a + (b - a) * ((plane - a[axis]) / (b[axis] - a[axis]));
+                    p[axis]     = plane;
+                    out[kept++] = p;
+                }
+            }
+
+            count   = kept;
+            current = 1 - current;
+
+            if (count == 0) return false;
+        }
+    }
+
+    clipped = AABB::empty();
+
+    for (int i = 0; i < count; i++)
+    {
+        clipped.expand(polygon[current][i]);
+    }
+
+    // Rounding may leave the polygon a little outside of box
+    clipped = clipped.overlap(box);
+
+    return true;
+}
+
+SpatialKDTree::SpatialKDTree(const std::vector<Triangle *>& tris)
+{
+    std::vector<Reference> refs;
+
+    refs.reserve(tris.size());
+    bounds = AABB::empty();
+
+    for (auto tri : tris)
+    {
+        refs.push_back(Reference{ tri, tri->getBoundingBox() });
+        bounds.expand(refs.back().box);
+    }
+
+    if (refs.empty()) return;
+
+    // Usual depth limit for kd-trees, deep enough for the SAH to stop first
+    const int maxDepth = std::min(MAX_DEPTH, (int)(8 + 1.3f * std::log2((float)refs.size())));
+
+    buildNode(refs, bounds, 0, maxDepth);
+}
+
+// The split is chosen by a full sweep over the clipped reference bounds on each
+// axis. A reference lying in the split plane goes to whichever side is cheaper,
+// every other one to each side it reaches into, clipped to that side. Planes on
+// the node bounds are allowed when they cut the triangles lying in them off
+// into a flat cell, which is how the walls of a box get separated.
+void SpatialKDTree::buildNode(std::vector<Reference>& refs, const AABB& box, int depth, int maxDepth)
+{
+    const unsigned nodeIndex = (unsigned)nodes.size();
+    const size_t   count     = refs.size();
+    const float    area      = box.getHalfArea();
+
+    nodes.push_back(SplitNode());
+
+    if ((count <= 1) || (depth >= maxDepth) || (area <= 0.0f))
+    {
+        makeLeaf(nodeIndex, refs);
+
+        return;
+    }
+
+    const glm::vec3 extent    = box.getMax() - box.getMin();
+    const float     leafCost  = SAH_INTERSECTION_COST * count;
+    float           bestCost  = INFINITY;
+    int             bestAxis  = -1;
+    float           bestSplit = 0.0f;
+    bool            bestPlanarLeft = true;
+
+    std::vector<float> mins, maxs, planars, candidates;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (extent[axis] <= 0.0f) continue;
+
+        mins.clear();
+        maxs.clear();
+        planars.clear();
+
+        for (auto& ref : refs)
+        {
+            const float lo = ref.box.getMin()[axis];
+            const float hi = ref.box.getMax()[axis];
+
+            if (lo == hi)
+            {
+                planars.push_back(lo);
+            }
+            else
+            {
+                mins.push_back(lo);
+                maxs.push_back(hi);
+            }
+        }
+
+        std::sort(mins.begin(), mins.end());
+        std::sort(maxs.begin(), maxs.end());
+        std::sort(planars.begin(), planars.end());
+
+        candidates.assign(mins.begin(), mins.end());
+        candidates.insert(candidates.end(), maxs.begin(), maxs.end());
+        candidates.insert(candidates.end(), planars.begin(), planars.end());
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+        // Counts of the references starting below, ending at or below and lying
+        // in a plane below / at or below the current candidate
+        size_t minsBelow = 0, maxsBelow = 0, planarsBelow = 0, planarsAt = 0;
+        const float lower = box.getMin()[axis];
+        const float upper = box.getMax()[axis];
+
+        for (float split : candidates)
+        {
+            while (minsBelow < mins.size() && mins[minsBelow] < split) minsBelow++;
+
+            while (maxsBelow < maxs.size() && maxs[maxsBelow] <= split) maxsBelow++;
+
+            while (planarsBelow < planars.size() && planars[planarsBelow] < split) planarsBelow++;
+
+            planarsAt = planarsBelow;
+
+            while (planarsAt < planars.size() && planars[planarsAt] == split) planarsAt++;
+
+            const size_t inPlane = planarsAt - planarsBelow;
+
+            if ((split < lower) || (split > upper)) continue;
+
+            // A flat cell on the bounds is only worth it with something in it
+            if (((split == lower) || (split == upper)) && (inPlane == 0)) continue;
+
+            glm::vec3 leftExtent  = extent;
+            glm::vec3 rightExtent = extent;
+            leftExtent[axis]  = split - lower;
+            rightExtent[axis] = upper - split;
+
+            const float leftArea  = halfArea(leftExtent);
+            const float rightArea = halfArea(rightExtent);
+
+            for (int planarLeft = 0; planarLeft < 2; planarLeft++)
+            {
+                // The flat cell has to be the one getting the planar triangles
+                if ((split == lower) && !planarLeft) continue;
+
+                if ((split == upper) && planarLeft) continue;
+
+                const size_t leftCount  = minsBelow + planarsBelow + (planarLeft ? inPlane : 0);
+                const size_t rightCount = (maxs.size() - maxsBelow) + (planars.size() - planarsAt) +
+                                          (planarLeft ? 0 : inPlane);
+
+                const float bonus = (leftCount == 0 || rightCount == 0) ? 1.0f - EMPTY_BONUS : 1.0f;
+                const float cost  = SAH_TRAVERSAL_COST + SAH_INTERSECTION_COST * bonus / area *
+                                    (leftArea * leftCount + rightArea * rightCount);
+
+                if (cost < bestCost)
+                {
+                    bestCost       = cost;
+                    bestAxis       = axis;
+                    bestSplit      = split;
+                    bestPlanarLeft = planarLeft != 0;
+                }
+            }
+        }
+    }
+
+    if ((bestAxis < 0) || (bestCost >= leafCost))
+    {
+        makeLeaf(nodeIndex, refs);
+
+        return;
+    }
+
+    glm::vec3 leftMax  = box.getMax();
+    glm::vec3 rightMin = box.getMin();
+    leftMax[bestAxis]  = bestSplit;
+    rightMin[bestAxis] = bestSplit;
+
+    const AABB leftBox(box.getMin(), leftMax);
+    const AABB rightBox(rightMin, box.getMax());
+
+    std::vector<Reference> leftRefs, rightRefs;
+
+    for (auto& ref : refs)
+    {
+        const float lo = ref.box.getMin()[bestAxis];
+        const float hi = ref.box.getMax()[bestAxis];
+
+        if ((lo == bestSplit) && (hi == bestSplit))
+        {
+            bestPlanarLeft
+            ? leftRefs.push_back(ref)
+            : rightRefs.push_back(ref);
+        }
+        else if (hi <= bestSplit)
+        {
+            leftRefs.push_back(ref);
+        }
+        else if (lo >= bestSplit)
+        {
+            rightRefs.push_back(ref);
+        }
+        else
+        {
+            // Straddles the plane, the clipped triangle may still miss a side
+            const Triangle& tri = *ref.triangle;
+            AABB clipped;
+
+            if (clipTriangle(tri, ref.box.overlap(leftBox), clipped))
+            {
+                leftRefs.push_back(Reference{ ref.triangle, clipped });
+            }
+
+            if (clipTriangle(tri, ref.box.overlap(rightBox), clipped))
+            {
+                rightRefs.push_back(Reference{ ref.triangle, clipped });
+            }
+        }
+    }
+
+    // Only the children's references are needed from here on
+    std::vector<Reference>().swap(refs);
+
+    buildNode(leftRefs, leftBox, depth + 1, maxDepth);
+
+    nodes[nodeIndex].split = bestSplit;
+    nodes[nodeIndex].flags = (unsigned)bestAxis | ((unsigned)nodes.size() << 2);
+
+    buildNode(rightRefs, rightBox, depth + 1, maxDepth);
+}
+
+void SpatialKDTree::makeLeaf(unsigned nodeIndex, const std::vector<Reference>& refs)
+{
+    std::vector<const Triangle *> tris;
+
+    for (auto& ref : refs)
+    {
+        tris.push_back(ref.triangle);
+    }
+
+    nodes[nodeIndex].offset = packets.add(tris.data(), tris.size());
+    nodes[nodeIndex].flags  = 3 | ((unsigned)refs.size() << 2);
+}
+
+bool SpatialKDTree::hit(const Ray& ray, float& tmin, long& tri_idx) const
+{
+    return traverse<false>(ray, tmin, tri_idx);
+}
+
+bool SpatialKDTree::occluded(const Ray& ray, float tMax) const
+{
+    long tri_idx;
+
+    return traverse<true>(ray, tMax, tri_idx);
+}
+
+// Walks the cells pierced by ray front to back, each with the interval of the
+// ray inside it. The first cell that holds a hit closer than its exit ends the
+// walk, since every cell left on the stack starts behind it.
+template<bool AnyHit>
+bool SpatialKDTree::traverse(const Ray& ray, float& tmin, long& tri_idx) const
+{
+    struct Entry
+    {
+        unsigned node;
+        float    tMin;
+        float    tMax;
+    };
+
+    Entry    stack[MAX_DEPTH];
+    int      stackSize = 0;
+    unsigned current   = 0;
+    float    cellMin, cellMax;
+    bool     hit_tri   = false;
+
+    if (nodes.empty() || !bounds.intersection(ray, tmin, cellMin, cellMax)) return false;
+
+    while (true)
+    {
+        const SplitNode& node = nodes[current];
+
+        RayStats::countNode();
+
+        if (!node.isLeaf())
+        {
+            const unsigned axis   = node.axis();
+            const float    origin = ray.origin[axis];
+            const float    tPlane = (node.split - origin) * ray.direction_inv[axis];
+
+            // A ray starting in the plane belongs to the side it heads into
+            const bool     belowFirst = (origin < node.split) ||
+                                        (origin == node.split && ray.direction[axis] <= 0.0f);
+            const unsigned first      = belowFirst ? current + 1 : node.data();
+            const unsigned second     = belowFirst ? node.data() : current + 1;
+
+            // Parallel rays give an infinite or NaN distance and stay on one side
+            if (!(tPlane > 0.0f) || (tPlane > cellMax))
+            {
+                current = first;
+            }
+            else if (tPlane < cellMin)
+            {
+                current = second;
+            }
+            else
+            {
+                stack[stackSize++] = { second, tPlane, cellMax };
+                current            = first;
+                cellMax            = tPlane;
+            }
+
+            continue;
+        }
+
+        if (AnyHit)
+        {
+            if (packets.occluded(ray, node.offset, node.data(), tmin)) return true;
+        }
+        else if (packets.intersect(ray, node.offset, node.data(), tmin, tri_idx))
+        {
+            hit_tri = true;
+        }
+
+        if (hit_tri && (tmin <= cellMax)) return true;
+
+        if (stackSize == 0) return hit_tri;
+
+        const Entry& entry = stack[--stackSize];
+
+        if (entry.tMin > tmin) return hit_tri;
+
+        current = entry.node;
+        cellMin = entry.tMin;
+        cellMax = entry.tMax;
+    }
+}
+
+TreeStats SpatialKDTree::getStats() const
+{
+    TreeStats stats;
+
+    if (nodes.empty()) return stats;
+
+    const float rootArea = bounds.getHalfArea();
+
+    collectStats(stats, 0, bounds, 0, rootArea > 0.0f ? 1.0f / rootArea : 0.0f);
+
+    return stats;
+}
+
+void SpatialKDTree::collectStats(TreeStats& stats, unsigned nodeIndex, const AABB& box, int depth,
+                                 float invRootArea) const
+{
+    const SplitNode& node = nodes[nodeIndex];
+    const float      area = box.getHalfArea() * invRootArea;
+
+    if (node.isLeaf())
+    {
+        stats.addLeaf(node.data(), area, depth);
+
+        return;
+    }
+
+    glm::vec3 leftMax  = box.getMax();
+    glm::vec3 rightMin = box.getMin();
+    leftMax[node.axis()]  = node.split;
+    rightMin[node.axis()] = node.split;
+
+    stats.addInner(area, depth);
+    collectStats(stats, nodeIndex + 1, AABB(box.getMin(), leftMax), depth + 1, invRootArea);
+    collectStats(stats, node.data(), AABB(rightMin, box.getMax()), depth + 1, invRootArea);
+}
@@ -44,48 +44,25 @@ Triangle::Triangle(const glm::vec3& v1, const glm::vec3& v2, const glm::vec3& v3
     }
 }
 
-glm::vec3 Triangle::getRandomPositionOnSurface() const
+glm::vec3 Triangle::getRandomPositionOnSurface(Random& random) const
 {
-    glm::vec3 v1                       = vertices[1] - vertices[0];
-    glm::vec3 v2                       = vertices[2] - vertices[0];
-    glm::vec3 randomRectanglePoint     = (rand() / (float)RAND_MAX) * v1 + (rand() / (float)RAND_MAX) * v2;
-    glm::vec3 pointProjectedOnV1V2Line = glm::closestPointOnLine(randomRectanglePoint, v1, v2);
+    const glm::vec3 v1 = vertices[1] - vertices[0];
+    const glm::vec3 v2 = vertices[2] - vertices[0];
+    float s            = random.nextFloat();
+    float t            = random.nextFloat();
 
-    // If its further to the random point than to the line point then we're outside the triangle
-    if (glm::length(randomRectanglePoint) > glm::length(pointProjectedOnV1V2Line))
+    // A point of the parallelogram beyond the far edge is mirrored through
+    // the middle of that edge, onto the triangle, so the density stays uniform
+    if (s + t > 1.0f)
     {
-        // Move random point inside triangle
-        randomRectanglePoint += (pointProjectedOnV1V2Line - randomRectanglePoint) * 2.0f;
+        s = 1.0f - s;
+        t = 1.0f - t;
     }
 
-    return vertices[0] + randomRectanglePoint;
+    return vertices[0] + s * v1 + t * v2;
 }
 
 bool Triangle::rayIntersection(const Ray& ray, float& intersectedDistance) const
 {
-    // Calculate intersection using barycentric coordinates
-    // This gives a equation system which we can solve using Cramer's rule
-    const glm::vec3 E1      = vertices[1] - vertices[0];
-    const glm::vec3 E2      = vertices[2] - vertices[0];
-    const glm::vec3 P       = glm::cross(ray.direction, E2);
-    const glm::vec3 T       = ray.origin - vertices[0];
-    const float     inv_den = 1.0f / glm::dot(E1, P);
-    float u                 = inv_den * glm::dot(T, P);
-
-    if ((u < 0.0f) || (u > 1.0f))
-    {
-        return false;
-    }
-
-    const glm::vec3 Q = glm::cross(T, E1);
-    const float     v = inv_den * glm::dot(ray.direction, Q);
-
-    if ((v < 0.0f) || (u + v > 1.0f))
-    {
-        return false;
-    }
-
-    intersectedDistance = inv_den * glm::dot(E2, Q);
-
-    return intersectedDistance > std::numeric_limits<float>::min();
+    return intersect(ray, vertices[0], edges[0], edges[1], intersectedDistance);
 }
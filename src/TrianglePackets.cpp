@@ -0,0 +1,172 @@
+#include "TrianglePackets.h"
+
+#include <cfloat>
+#include <algorithm>
+#include <limits>
+
+#include <xmmintrin.h>
+
+#include "Simd.h"
+#include "RayStats.h"
+
+static_assert(sizeof(TrianglePacket) == Simd::TRIANGLE_PACKET_FLOATS * sizeof(float),
+              "The SIMD kernels read packets as plain floats");
+
+// Same steps as Triangle::intersect on the 4 triangles of packet, a NaN
+// anywhere fails the comparisons. Returns the slot of the closest hit before
+// tMax, which is moved to the hit, or -1.
+static inline int intersectPacket4(const TrianglePacket& packet, const SimdRay& ray, float& tMax)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one  = _mm_set1_ps(1.0f);
+    const __m128 dx   = _mm_set1_ps(ray.direction[0]);
+    const __m128 dy   = _mm_set1_ps(ray.direction[1]);
+    const __m128 dz   = _mm_set1_ps(ray.direction[2]);
+    const __m128 e1x  = _mm_load_ps(packet.e1[0]);
+    const __m128 e1y  = _mm_load_ps(packet.e1[1]);
+    const __m128 e1z  = _mm_load_ps(packet.e1[2]);
+    const __m128 e2x  = _mm_load_ps(packet.e2[0]);
+    const __m128 e2y  = _mm_load_ps(packet.e2[1]);
+    const __m128 e2z  = _mm_load_ps(packet.e2[2]);
+
+    // P = cross(direction, e2)
+    const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+
+    // T = origin - v0
+    const __m128 tx = _mm_sub_ps(_mm_set1_ps(ray.origin[0]), _mm_load_ps(packet.v0[0]));
+    const __m128 ty = _mm_sub_ps(_mm_set1_ps(ray.origin[1]), _mm_load_ps(packet.v0[1]));
+    const __m128 tz = _mm_sub_ps(_mm_set1_ps(ray.origin[2]), _mm_load_ps(packet.v0[2]));
+
+    const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    const __m128 inv = _mm_div_ps(one, det);
+    const __m128 u   = _mm_mul_ps(inv, _mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)),
+                                                  _mm_mul_ps(tz, pz)));
+
+    __m128 valid = _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one));
+
+    if (_mm_movemask_ps(valid) == 0) return -1;
+
+    // Q = cross(T, e1)
+    const __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+    const __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+    const __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+
+    const __m128 v = _mm_mul_ps(inv, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)),
+                                                _mm_mul_ps(dz, qz)));
+    const __m128 t = _mm_mul_ps(inv, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)),
+                                                _mm_mul_ps(e2z, qz)));
+
+    valid = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+    valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), one));
+    valid = _mm_and_ps(valid, _mm_cmpgt_ps(t, _mm_set1_ps(FLT_MIN)));
+    valid = _mm_and_ps(valid, _mm_cmplt_ps(t, _mm_set1_ps(tMax)));
+
+    const int mask = _mm_movemask_ps(valid);
+
+    if (mask == 0) return -1;
+
+    float distances[4];
+    int   hit = -1;
+
+    _mm_storeu_ps(distances, t);
+
+    for (int slot = 0; slot < 4; slot++)
+    {
+        if ((mask & (1 << slot)) && (distances[slot] < tMax))
+        {
+            tMax = distances[slot];
+            hit  = slot;
+        }
+    }
+
+    return hit;
+}
+
+unsigned TrianglePackets::add(const Triangle *const * tris, size_t count)
+{
+    const unsigned first = (unsigned)storage.size();
+    const float    nan   = std::numeric_limits<float>::quiet_NaN();
+
+    storage.resize(first + (count + 3) / 4);
+    packets = storage;
+
+    for (size_t i = 0; i < (storage.size() - first) * 4; i++)
+    {
+        TrianglePacket& packet = storage[first + i / 4];
+        const size_t    slot   = i % 4;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            packet.v0[axis][slot] = i < count ? tris[i]->vertices[0][axis] : nan;
+            packet.e1[axis][slot] = i < count ? tris[i]->edges[0][axis] : nan;
+            packet.e2[axis][slot] = i < count ? tris[i]->edges[1][axis] : nan;
+        }
+
+        packet.id[slot] = i < count ? tris[i]->meshIndex : -1;
+    }
+
+    return first;
+}
+
+// A single packet goes through the SSE kernel even with AVX2 at hand, the
+// upper half of the 8 wide one would only test padding
+bool TrianglePackets::intersect(const Ray& ray, unsigned first, unsigned count, float& tmin, long& id) const
+{
+    static const bool avx2 = Simd::hasAVX2();
+
+    const unsigned packetCount = (count + 3) / 4;
+    SimdRay        simdRay;
+    int            hit = -1;
+
+    RayStats::countTriangles(count);
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        simdRay.origin[axis]    = ray.origin[axis];
+        simdRay.direction[axis] = ray.direction[axis];
+    }
+
+    if (avx2 && (packetCount > 1))
+    {
+        hit = Simd::intersectTriangles8AVX2(packets[first].v0[0], packetCount, simdRay, tmin);
+    }
+    else
+    {
+        for (unsigned packet = 0; packet < packetCount; packet++)
+        {
+            const int slot = intersectPacket4(packets[first + packet], simdRay, tmin);
+
+            if (slot >= 0) hit = (int)packet * 4 + slot;
+        }
+    }
+
+    if (hit < 0) return false;
+
+    id = packets[first + hit / 4].id[hit % 4];
+
+    return true;
+}
+
+// Packet by packet with the SSE kernel, the 8 wide one would test the whole
+// leaf before it could return
+bool TrianglePackets::occluded(const Ray& ray, unsigned first, unsigned count, float tMax) const
+{
+    SimdRay simdRay;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        simdRay.origin[axis]    = ray.origin[axis];
+        simdRay.direction[axis] = ray.direction[axis];
+    }
+
+    for (unsigned tested = 0; tested < count; tested += 4)
+    {
+        RayStats::countTriangles(std::min(count - tested, 4u));
+
+        if (intersectPacket4(packets[first + tested / 4], simdRay, tMax) >= 0) return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,289 @@
+#include <cmath>
+#include <algorithm>
+
+#include <xmmintrin.h>
+
+#include "WideBVH.h"
+#include "Simd.h"
+#include "RayStats.h"
+
+// Tests ray against the four boxes of node starting at lane
+template<int N>
+static inline int intersectBoxes4(const WideNode<N>& node,
+                                  int                lane,
+                                  const SimdRay    & ray,
+                                  float              tMax,
+                                  float            * tEntry)
+{
+    __m128 tNear = _mm_setzero_ps();
+    __m128 tFar  = _mm_set1_ps(tMax);
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        const __m128 origin = _mm_set1_ps(ray.origin[axis]);
+        const __m128 inv    = _mm_set1_ps(ray.invDirection[axis]);
+        const __m128 near   = _mm_load_ps(&node.bounds[ray.sign[axis]][axis][lane]);
+        const __m128 far    = _mm_load_ps(&node.bounds[1 - ray.sign[axis]][axis][lane]);
+
+        // The slab distance goes first: max and min return the second operand
+        // when one is NaN, which happens for 0 * inf on a box plane
+        tNear = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(near, origin), inv), tNear);
+        tFar  = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(far, origin), inv), tFar);
+    }
+
+    _mm_storeu_ps(tEntry + lane, tNear);
+
+    return _mm_movemask_ps(_mm_cmple_ps(tNear, tFar)) << lane;
+}
+
+static inline int intersectChildren(const WideNode<4>& node, const SimdRay& ray, float tMax, float* tEntry)
+{
+    return intersectBoxes4(node, 0, ray, tMax, tEntry);
+}
+
+static inline int intersectChildren(const WideNode<8>& node, const SimdRay& ray, float tMax, float* tEntry)
+{
+    static const bool avx2 = Simd::hasAVX2();
+
+    if (avx2)
+    {
+        return Simd::intersectBoxes8AVX2(&node.bounds[0][0][0], ray, tMax, tEntry);
+    }
+
+    return intersectBoxes4(node, 0, ray, tMax, tEntry) | intersectBoxes4(node, 4, ray, tMax, tEntry);
+}
+
+template<int N>
+static AABB childBox(const WideNode<N>& node, int slot)
+{
+    return AABB(glm::vec3(node.bounds[0][0][slot], node.bounds[0][1][slot], node.bounds[0][2][slot]),
+                glm::vec3(node.bounds[1][0][slot], node.bounds[1][1][slot], node.bounds[1][2][slot]));
+}
+
+template<int N>
+WideBVH<N>::WideBVH(const std::vector<Triangle *>& tris, const BuildOptions& options)
+{
+    Arena   arena;
+    KDNode* root = KDNode::buildTree(tris, options, arena);
+
+    if (!tris.empty())
+    {
+        collapse(root);
+    }
+}
+
+// Creates a wide node from the binary subtree at node. Starting with its two
+// children, the inner child with the largest surface area is replaced by its
+// own children until all N slots are used or only leaves are left.
+template<int N>
+int WideBVH<N>::collapse(const KDNode* node)
+{
+    const KDNode* children[N];
+    int childCount = 0;
+
+    if (node->leaf)
+    {
+        children[childCount++] = node;
+    }
+    else
+    {
+        children[childCount++] = node->left;
+        children[childCount++] = node->right;
+    }
+
+    while (childCount < N)
+    {
+        int   best     = -1;
+        float bestArea = -1.0f;
+
+        for (int i = 0; i < childCount; i++)
+        {
+            if (!children[i]->leaf && (children[i]->box.getHalfArea() > bestArea))
+            {
+                best     = i;
+                bestArea = children[i]->box.getHalfArea();
+            }
+        }
+
+        if (best < 0) break;
+
+        const KDNode* expanded = children[best];
+        children[best]         = expanded->left;
+        children[childCount++] = expanded->right;
+    }
+
+    const int index = (int)nodes.size();
+    nodes.push_back(WideNode<N>());
+
+    for (int slot = 0; slot < N; slot++)
+    {
+        const bool used = slot < childCount;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            nodes[index].bounds[0][axis][slot] = used ? children[slot]->box.getMin()[axis] : INFINITY;
+            nodes[index].bounds[1][axis][slot] = used ? children[slot]->box.getMax()[axis] : -INFINITY;
+        }
+
+        nodes[index].child[slot] = -1;
+        nodes[index].count[slot] = 0;
+
+        if (!used) continue;
+
+        if (children[slot]->leaf)
+        {
+            nodes[index].child[slot] = (int)packets.add(children[slot]->triangles,
+                                                        children[slot]->triangleCount);
+            nodes[index].count[slot] = (unsigned)children[slot]->triangleCount;
+        }
+        else
+        {
+            const int child = collapse(children[slot]);
+            nodes[index].child[slot] = child;
+        }
+    }
+
+    return index;
+}
+
+template<int N>
+bool WideBVH<N>::hit(const Ray& ray, float& tmin, long& tri_idx) const
+{
+    return traverse<false>(ray, tmin, tri_idx);
+}
+
+template<int N>
+bool WideBVH<N>::occluded(const Ray& ray, float tMax) const
+{
+    long tri_idx;
+
+    return traverse<true>(ray, tMax, tri_idx);
+}
+
+// Children hit by the ray are pushed sorted far to near, so the nearest one
+// is visited next. Leaves are pushed like nodes and tested when popped.
+template<int N>
+template<bool AnyHit>
+bool WideBVH<N>::traverse(const Ray& ray, float& tmin, long& tri_idx) const
+{
+    struct Entry
+    {
+        int      index;
+        unsigned count;
+        float    t;
+    };
+
+    Entry stack[KDTree::MAX_DEPTH * (N - 1) + 1];
+    int   stackSize = 0;
+    bool  hit_tri   = false;
+
+    if (nodes.empty()) return false;
+
+    SimdRay simdRay;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        simdRay.origin[axis]       = ray.origin[axis];
+        simdRay.direction[axis]    = ray.direction[axis];
+        simdRay.invDirection[axis] = ray.direction_inv[axis];
+        simdRay.sign[axis]         = ray.sign[axis];
+    }
+
+    stack[stackSize++] = { 0, 0, 0.0f };
+
+    while (stackSize > 0)
+    {
+        const Entry entry = stack[--stackSize];
+
+        if (entry.t > tmin) continue;
+
+        if (entry.count > 0)
+        {
+            if (AnyHit)
+            {
+                if (packets.occluded(ray, entry.index, entry.count, tmin)) return true;
+            }
+            else if (packets.intersect(ray, entry.index, entry.count, tmin, tri_idx))
+            {
+                hit_tri = true;
+            }
+
+            continue;
+        }
+
+        const WideNode<N>& node = nodes[entry.index];
+        float tEntry[N];
+
+        RayStats::countNode();
+
+        const int mask  = intersectChildren(node, simdRay, tmin, tEntry);
+        const int first = stackSize;
+
+        for (int slot = 0; slot < N; slot++)
+        {
+            if ((mask & (1 << slot)) == 0) continue;
+
+            // Insertion sort, farthest at the bottom
+            const Entry child = { node.child[slot], node.count[slot], tEntry[slot] };
+            int j             = stackSize++;
+
+            while ((j > first) && (stack[j - 1].t < child.t))
+            {
+                stack[j] = stack[j - 1];
+                j--;
+            }
+
+            stack[j] = child;
+        }
+    }
+
+    return hit_tri;
+}
+
+template<int N>
+TreeStats WideBVH<N>::getStats() const
+{
+    TreeStats stats;
+
+    if (nodes.empty()) return stats;
+
+    AABB root = AABB::empty();
+
+    for (int slot = 0; slot < N; slot++)
+    {
+        if (nodes[0].child[slot] < 0) continue;
+
+        root.expand(childBox(nodes[0], slot));
+    }
+
+    stats.addInner(1.0f, 0);
+    collectStats(stats, 0, 0, root.getHalfArea() > 0.0f ? 1.0f / root.getHalfArea() : 0.0f);
+
+    return stats;
+}
+
+template<int N>
+void WideBVH<N>::collectStats(TreeStats& stats, int nodeIndex, int depth, float invRootArea) const
+{
+    const WideNode<N>& node = nodes[nodeIndex];
+
+    for (int slot = 0; slot < N; slot++)
+    {
+        if (node.child[slot] < 0) continue;
+
+        const float area = childBox(node, slot).getHalfArea() * invRootArea;
+
+        if (node.count[slot] > 0)
+        {
+            stats.addLeaf(node.count[slot], area, depth + 1);
+        }
+        else
+        {
+            stats.addInner(area, depth + 1);
+            collectStats(stats, node.child[slot], depth + 1, invRootArea);
+        }
+    }
+}
+
+template class WideBVH<4>;
+template class WideBVH<8>;
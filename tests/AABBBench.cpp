@@ -0,0 +1,102 @@
+// Times AABB::intersection against the slab test it replaced, which sorted the
+// near and far distances per axis, over every pair of a set of rays and boxes
+// as a traversal would visit them.
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include "AABB.hpp"
+
+// The previous test, with a swap per axis to order the slab distances
+static bool swapIntersection(const glm::vec3& lo,
+                             const glm::vec3& hi,
+                             const Ray      & r,
+                             float            tMax,
+                             float          & tEntry)
+{
+    glm::vec3 tNear = (lo - r.origin) * r.direction_inv;
+    glm::vec3 tFar  = (hi - r.origin) * r.direction_inv;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (tFar[axis] < tNear[axis]) std::swap(tFar[axis], tNear[axis]);
+    }
+
+    const float minOfMax = std::min(tFar.x, std::min(tFar.y, std::min(tFar.z, tMax)));
+    const float maxOfMin = std::max(tNear.x, std::max(tNear.y, std::max(tNear.z, 0.0f)));
+
+    tEntry = maxOfMin;
+
+    return minOfMax >= maxOfMin;
+}
+
+int main()
+{
+    const int BOXES   = 4096;
+    const int RAYS    = 4096;
+    const int REPEATS = 3;
+
+    std::mt19937 generator(7);
+
+    const auto uniform = [&](float range) {
+            return std::uniform_real_distribution<float>(-range, range)(generator);
+        };
+
+    std::vector<AABB> boxes;
+    std::vector<Ray>  rays;
+
+    for (int i = 0; i < BOXES; i++)
+    {
+        const glm::vec3 center(uniform(4.0f), uniform(4.0f), uniform(4.0f));
+        const glm::vec3 extent = glm::abs(glm::vec3(uniform(0.2f), uniform(0.2f), uniform(0.2f)));
+
+        boxes.push_back(AABB(center - extent, center + extent));
+    }
+
+    for (int i = 0; i < RAYS; i++)
+    {
+        rays.push_back(Ray(glm::vec3(uniform(4.0f), uniform(4.0f), uniform(4.0f)),
+                           glm::normalize(glm::vec3(uniform(1.0f), uniform(1.0f), uniform(1.0f)))));
+    }
+
+    const double tests = (double)BOXES * RAYS;
+
+    for (int repeat = 0; repeat < REPEATS; repeat++)
+    {
+        long  swapHits = 0;
+        long  slabHits = 0;
+        float t;
+
+        const auto start = std::chrono::steady_clock::now();
+
+        for (const Ray& ray : rays)
+        {
+            for (const AABB& box : boxes)
+            {
+                swapHits += swapIntersection(box.getMin(), box.getMax(), ray, INFINITY, t);
+            }
+        }
+
+        const auto middle = std::chrono::steady_clock::now();
+
+        for (const Ray& ray : rays)
+        {
+            for (const AABB& box : boxes)
+            {
+                slabHits += box.intersection(ray, INFINITY, t);
+            }
+        }
+
+        const auto end = std::chrono::steady_clock::now();
+
+        std::printf("swap %.2f ns/test, sign-indexed slab %.2f ns/test (hits %ld / %ld)\n",
+                    std::chrono::duration<double, std::nano>(middle - start).count() / tests,
+                    std::chrono::duration<double, std::nano>(end - middle).count() / tests,
+                    swapHits, slabHits);
+    }
+
+    return 0;
+}
@@ -0,0 +1,166 @@
+// Checks AABB::intersection against a double precision slab test that handles
+// zero direction components by their own case. Exits with 1 on a mismatch.
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <algorithm>
+
+#include "AABB.hpp"
+
+// Whether the ray enters [lo, hi] before tMax. Sets borderline when entry and
+// exit are close enough that float rounding may decide either way.
+static bool referenceIntersection(const glm::vec3& lo,
+                                  const glm::vec3& hi,
+                                  const glm::vec3& origin,
+                                  const glm::vec3& direction,
+                                  double           tMax,
+                                  bool           & borderline)
+{
+    double tEntry = 0.0;
+    double tExit  = tMax;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        const double o = origin[axis];
+        const double d = direction[axis];
+
+        // Parallel to the slab, inside it for good or never
+        if (d == 0.0)
+        {
+            if ((o < lo[axis]) || (o > hi[axis])) return false;
+
+            continue;
+        }
+
+        double tNear = (lo[axis] - o) / d;
+        double tFar  = (hi[axis] - o) / d;
+
+        if (tNear > tFar) std::swap(tNear, tFar);
+
+        tEntry = std::max(tEntry, tNear);
+        tExit  = std::min(tExit, tFar);
+    }
+
+    borderline = std::fabs(tExit - tEntry) <= 1e-5 * std::max(1.0, std::fabs(tExit));
+
+    return tEntry <= tExit;
+}
+
+// Whether the box test agrees with the reference, which borderline cases
+// always do. Prints the case otherwise.
+static bool check(const glm::vec3& lo,
+                  const glm::vec3& hi,
+                  const glm::vec3& origin,
+                  const glm::vec3& direction,
+                  float            tMax)
+{
+    bool       borderline = false;
+    const bool expected   = referenceIntersection(lo, hi, origin, direction, tMax, borderline);
+    float      tEntry, tExit;
+    const bool result     = AABB(lo, hi).intersection(Ray(origin, direction), tMax, tEntry, tExit);
+
+    if ((expected == result) || borderline) return true;
+
+    std::printf("Mismatch: expected %d, got %d for origin (%g, %g, %g), direction (%g, %g, %g), "
+                "box (%g, %g, %g) - (%g, %g, %g), tMax %g\n",
+                expected, result, origin.x, origin.y, origin.z, direction.x, direction.y, direction.z,
+                lo.x, lo.y, lo.z, hi.x, hi.y, hi.z, tMax);
+
+    return false;
+}
+
+int main()
+{
+    const glm::vec3 lo(-1.0f);
+    const glm::vec3 hi(1.0f);
+    long failures = 0;
+
+    // Axis-parallel rays with +0 and -0 in the other components, from inside,
+    // from outside and from the slab planes themselves
+    const float zeros[]   = { 0.0f, -0.0f };
+    const float offsets[] = { -2.0f, -1.0f, 0.0f, 1.0f, 2.0f };
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        for (float along : { 1.0f, -1.0f })
+        {
+            for (float zero : zeros)
+            {
+                for (float u : offsets)
+                {
+                    for (float v : offsets)
+                    {
+                        glm::vec3 direction(zero);
+                        glm::vec3 origin;
+
+                        direction[axis]        = along;
+                        origin[axis]           = -3.0f * along;
+                        origin[(axis + 1) % 3] = u;
+                        origin[(axis + 2) % 3] = v;
+
+                        failures += !check(lo, hi, origin, direction, INFINITY);
+                    }
+                }
+            }
+        }
+    }
+
+    // Random boxes and rays, with zero components and origins on a slab plane
+    // mixed in
+    std::mt19937 generator(7);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    const long CASES      = 2000000;
+    long       zeroCases  = 0;
+    long       planeCases = 0;
+
+    const auto nextFloat = [&]() {
+            return unit(generator);
+        };
+    const auto uniform = [&](float range) {
+            return (2.0f * nextFloat() - 1.0f) * range;
+        };
+
+    for (long i = 0; i < CASES; i++)
+    {
+        const glm::vec3 a(uniform(4.0f), uniform(4.0f), uniform(4.0f));
+        const glm::vec3 b(uniform(4.0f), uniform(4.0f), uniform(4.0f));
+        const glm::vec3 boxLo = glm::min(a, b);
+        const glm::vec3 boxHi = glm::max(a, b);
+        glm::vec3 origin(uniform(4.0f), uniform(4.0f), uniform(4.0f));
+        glm::vec3 direction(uniform(4.0f), uniform(4.0f), uniform(4.0f));
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const float pick = nextFloat();
+
+            if (pick < 0.1f)
+            {
+                direction[axis] = 0.0f;
+                zeroCases++;
+            }
+            else if (pick < 0.2f)
+            {
+                direction[axis] = -0.0f;
+                zeroCases++;
+            }
+
+            if (nextFloat() < 0.1f)
+            {
+                origin[axis] = nextFloat() < 0.5f ? boxLo[axis] : boxHi[axis];
+                planeCases++;
+            }
+        }
+
+        if (direction == glm::vec3(0.0f)) continue;
+
+        const float tMax = nextFloat() < 0.5f ? INFINITY : std::fabs(uniform(8.0f));
+
+        if (!check(boxLo, boxHi, origin, direction, tMax) && (++failures > 10)) break;
+    }
+
+    std::printf("%ld random cases, %ld zero components, %ld origins on a plane: %ld mismatches\n",
+                CASES, zeroCases, planeCases, failures);
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,64 @@
+// Checks AliasTable against uneven weights, zero and negative ones included:
+// the probabilities it reports and how often sample picks each entry. Exits
+// with 1 on a mismatch.
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "AliasTable.h"
+#include "Random.hpp"
+
+int main()
+{
+    const std::vector<float> weights = { 4.0f, 0.0f, 1.0f, -2.0f, 0.5f, 9.0f, 0.0f, 2.5f, 3.0f };
+    const AliasTable table(weights);
+    long failures = 0;
+
+    double total = 0.0;
+
+    for (float w : weights)
+    {
+        total += std::fmax(w, 0.0f);
+    }
+
+    // Negative weights count as 0
+    for (unsigned i = 0; i < weights.size(); i++)
+    {
+        const double expected = std::fmax(weights[i], 0.0f) / total;
+
+        if (std::fabs(table.getProbability(i) - expected) > 1e-6)
+        {
+            std::printf("Entry %u: probability %g, expected %g\n", i, table.getProbability(i), expected);
+            failures++;
+        }
+    }
+
+    // Frequencies within 5 standard deviations of the binomial counts, entries
+    // without weight never picked
+    const long         SAMPLES = 4000000;
+    std::vector<long>  counts(weights.size(), 0);
+    Random             random(7);
+
+    for (long s = 0; s < SAMPLES; s++)
+    {
+        counts[table.sample(random)]++;
+    }
+
+    for (unsigned i = 0; i < weights.size(); i++)
+    {
+        const double p         = std::fmax(weights[i], 0.0f) / total;
+        const double expected  = p * SAMPLES;
+        const double tolerance = 5.0 * std::sqrt(SAMPLES * p * (1.0 - p));
+
+        if ((p == 0.0) ? (counts[i] != 0) : (std::fabs(counts[i] - expected) > tolerance))
+        {
+            std::printf("Entry %u: picked %ld times, expected %.0f +- %.0f\n", i, counts[i], expected, tolerance);
+            failures++;
+        }
+    }
+
+    std::printf("%u entries, %ld samples: %ld mismatches\n", table.size(), SAMPLES, failures);
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,156 @@
+// Checks the low-discrepancy samplers: Sobol points stratify the unit square
+// and are reproducible, the first base Halton samples of a dimension fall into
+// distinct strata, and the blue noise mask holds every rank once. Exits with 1
+// on a mismatch.
+
+#include <cstdio>
+#include <vector>
+
+#include "SobolSampler.h"
+#include "HaltonSampler.h"
+#include "BlueNoiseSampler.h"
+
+// The elementary interval of value among 2^bits equal parts of [0, 1)
+static uint32_t stratum(uint32_t value, int bits)
+{
+    return (uint32_t)((uint64_t)value >> (32 - bits));
+}
+
+// Whether the first 2^k points of the dimension pair starting at first put
+// exactly one point into every 2^a x 2^(k - a) box, for all a and k up to
+// maxBits
+static bool stratified(const Sampler& sampler, uint32_t first, uint32_t x, uint32_t y, int maxBits)
+{
+    for (int k = 0; k <= maxBits; k++)
+    {
+        for (int a = 0; a <= k; a++)
+        {
+            std::vector<char> hit((size_t)1 << k, 0);
+
+            for (uint32_t index = 0; index < (1u << k); index++)
+            {
+                const uint32_t u   = stratum(sampler.sample(index, first, x, y), a);
+                const uint32_t v   = stratum(sampler.sample(index, first + 1, x, y), k - a);
+                char         & box = hit[(u << (k - a)) | v];
+
+                if (box)
+                {
+                    std::printf("Sobol dimensions %u, %u of pixel (%u, %u): two of the first %u points "
+                                "share a %d x %d box\n", first, first + 1, x, y, 1u << k, 1 << a, 1 << (k - a));
+
+                    return false;
+                }
+
+                box = 1;
+            }
+        }
+    }
+
+    return true;
+}
+
+int main()
+{
+    long failures = 0;
+
+    // Sobol: stratified per pixel, for the first pair and pairs taken again
+    // with a shuffled order, and the same value for the same arguments
+    const SobolSampler sobol(3);
+    const SobolSampler sobolAgain(3);
+
+    const uint32_t pixels[][2] = { { 0, 0 }, { 17, 5 }, { 1023, 767 } };
+
+    for (const auto& pixel : pixels)
+    {
+        for (uint32_t first : { 0u, 2u, 6u })
+        {
+            failures += !stratified(sobol, first, pixel[0], pixel[1], 10);
+        }
+    }
+
+    for (uint32_t index = 0; index < 4096; index += 7)
+    {
+        for (uint32_t dimension = 0; dimension < 12; dimension++)
+        {
+            const uint32_t value = sobol.sample(index, dimension, index % 61, dimension * 13);
+
+            if ((sobol.sample(index, dimension, index % 61, dimension * 13) != value) ||
+                (sobolAgain.sample(index, dimension, index % 61, dimension * 13) != value))
+            {
+                std::printf("Sobol sample %u, dimension %u is not reproducible\n", index, dimension);
+                failures++;
+            }
+        }
+    }
+
+    // Halton: the first base samples of a dimension take the first digit of
+    // their index, scrambled, so each lands in a stratum of its own. A value
+    // that wrapped around from the top would share the lowest one.
+    const HaltonSampler halton(3);
+    const uint32_t      bases[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37 };
+
+    for (uint32_t dimension = 0; dimension < sizeof(bases) / sizeof(bases[0]); dimension++)
+    {
+        const uint32_t base = bases[dimension];
+
+        for (const auto& pixel : pixels)
+        {
+            std::vector<char> hit(base, 0);
+
+            for (uint32_t index = 0; index < base; index++)
+            {
+                const uint32_t value = halton.sample(index, dimension, pixel[0], pixel[1]);
+                const uint64_t part  = (uint64_t)value * base >> 32;
+
+                if ((part >= base) || hit[part])
+                {
+                    std::printf("Halton dimension %u of pixel (%u, %u): sample %u in stratum %llu of %u "
+                                "is not alone\n", dimension, pixel[0], pixel[1], index,
+                                (unsigned long long)part, base);
+                    failures++;
+
+                    break;
+                }
+
+                hit[part] = 1;
+            }
+        }
+    }
+
+    // Blue noise: over a mask sized block of pixels every texel shifts the
+    // same Sobol value once. The mask stores rank r as (r + 1/2) / AREA.
+    const uint32_t         seed = 3;
+    const BlueNoiseSampler blueNoise(seed);
+    const SobolSampler     shared(seed, false);
+    const int              AREA = BlueNoiseSampler::MASK_SIZE * BlueNoiseSampler::MASK_SIZE;
+
+    for (uint32_t dimension = 0; dimension < 4; dimension++)
+    {
+        const uint32_t    base = shared.sample(5, dimension, 0, 0);
+        std::vector<char> ranks(AREA, 0);
+        long              duplicates = 0;
+
+        for (uint32_t y = 0; y < BlueNoiseSampler::MASK_SIZE; y++)
+        {
+            for (uint32_t x = 0; x < BlueNoiseSampler::MASK_SIZE; x++)
+            {
+                const uint32_t shift = blueNoise.sample(5, dimension, x, y) - base;
+                const uint64_t rank  = (uint64_t)shift * AREA >> 32;
+
+                if (ranks[rank]) duplicates++;
+
+                ranks[rank] = 1;
+            }
+        }
+
+        if (duplicates > 0)
+        {
+            std::printf("Blue noise dimension %u: %ld ranks missing from the mask\n", dimension, duplicates);
+            failures++;
+        }
+    }
+
+    std::printf("Sobol, Halton and blue noise samplers: %ld mismatches\n", failures);
+
+    return failures == 0 ? 0 : 1;
+}